@@ -1,26 +1,54 @@
 #include "bitcask.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#include "direct_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace rd::bitcask {
 namespace {
 
-// Value written when a value is tombstoned. Keys with this value will be
-// ignored the next time the cask is loaded.
-constexpr std::string_view kTombstoneValue = "rdbc_tombstone";
-
 // Suffix given to Bitcask files.
 constexpr std::string_view kCaskSuffix = ".cask";
 
+// Suffix of a file being written by `Merge`. It only gets `kCaskSuffix` once
+// complete, so a merge interrupted part way through is never loaded.
+constexpr std::string_view kMergingSuffix = ".merging";
+
+// Suffix of the on-disk index of spilled KeyDir entries. Spill indices only
+// live as long as the Bitcask that created them.
+constexpr std::string_view kSpillSuffix = ".spill";
+
+// Name of the file listing the cask files of a checkpoint.
+constexpr std::string_view kManifestName = "MANIFEST";
+
+// Upper bound on the number of values `Merge` samples to train a dictionary.
+constexpr size_t kMaxDictionarySamples = 4096;
+
 // Reads bytes from `input` into `target.
 //
 // NOTE: this/the overload below do not check for eof(), e.g.:
@@ -34,7 +62,7 @@ void ReadToTarget(std::istream& input, T* target) {
   static_assert(!std::is_same_v<std::string, T>,
                 "Use the ReadToTarget overload that takes a std::string");
 
-  input.read((char*)target, sizeof(target));
+  input.read((char*)target, sizeof(T));
 }
 
 // String-specific ReadToTarget overload that writes `size` bytes from `input`
@@ -47,9 +75,79 @@ void ReadToTarget(std::istream& input, std::string* target, size_t size) {
   input.read(target->data(), size);
 }
 
-template <typename T>
-void WriteToTarget(std::ostream& output, T* target) {
-  output.write((char*)target, sizeof(target));
+// Advances `input` past `size` bytes without copying them anywhere.
+//
+// 💡: libstdc++'s filebuf throws its buffer away on every seekg(), so seeking
+// over a handful of bytes costs a syscall and a refill. Small skips stay
+// inside the buffer via ignore(); only large ones are worth a real seek.
+void SkipBytes(std::istream& input, size_t size) {
+  constexpr size_t kSeekThreshold = 4096;
+  if (size >= kSeekThreshold) {
+    input.seekg(size, std::ios::cur);
+  } else {
+    input.ignore(size);
+  }
+}
+
+// Heap bytes owned by `s`, or 0 if it fits in its inline (SSO) buffer.
+size_t HeapBytes(const std::string& s) {
+  const char* data = s.data();
+  const char* self = reinterpret_cast<const char*>(&s);
+  if (data >= self && data < self + sizeof(s)) {
+    return 0;
+  }
+  return s.capacity() + 1;
+}
+
+// Heap bytes a new string of `length` would allocate.
+size_t HeapBytes(size_t length) {
+  static const size_t inline_capacity = std::string().capacity();
+  return length > inline_capacity ? length + 1 : 0;
+}
+
+// 💡: libstdc++ nodes hold a next pointer and the cached hash alongside the
+// element itself.
+template <typename Map>
+constexpr size_t NodeBytes() {
+  return sizeof(void*) + sizeof(typename Map::value_type) + sizeof(size_t);
+}
+
+// 💡: libstdc++ red-black tree nodes hold a color and parent/left/right
+// pointers alongside the element.
+template <typename Set>
+constexpr size_t TreeNodeBytes() {
+  return 4 * sizeof(void*) + sizeof(typename Set::value_type);
+}
+
+// Writes one Prometheus metric family with a single unlabeled sample.
+void WriteMetric(std::ostream& output, std::string_view name,
+                 std::string_view type, std::string_view help,
+                 uint64_t value) {
+  output << "# HELP " << name << " " << help << "\n"
+         << "# TYPE " << name << " " << type << "\n"
+         << name << " " << value << "\n";
+}
+
+// Writes `latencies` (in nanoseconds) as a Prometheus summary in seconds.
+void WriteSummary(std::ostream& output, std::string_view name,
+                  std::string_view help, const Histogram& latencies) {
+  output << "# HELP " << name << " " << help << "\n"
+         << "# TYPE " << name << " summary\n";
+  for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+    output << name << "{quantile=\"" << quantile << "\"} "
+           << latencies.Percentile(quantile * 100) / 1e9 << "\n";
+  }
+  output << name << "_sum " << latencies.sum() / 1e9 << "\n"
+         << name << "_count " << latencies.count() << "\n";
+}
+
+// Reverses the order of the bits in `v`.
+size_t ReverseBits(size_t v) {
+  size_t reversed = 0;
+  for (size_t i = 0; i < 8 * sizeof(v); ++i, v >>= 1) {
+    reversed = (reversed << 1) | (v & 1);
+  }
+  return reversed;
 }
 
 int64_t NowToMicros() {
@@ -57,14 +155,201 @@ int64_t NowToMicros() {
              std::chrono::system_clock::now().time_since_epoch())
       .count();
 }
+
+// Flushes the file or directory at `path` to disk. Throws
+// `std::system_error` on failure.
+void SyncPath(const std::filesystem::path& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "open " + path.string());
+  }
+  int result = fsync(fd);
+  int error = errno;
+  close(fd);
+  if (result != 0) {
+    throw std::system_error(error, std::generic_category(),
+                            "fsync " + path.string());
+  }
+}
+
+// Restricts `thread` to run on `cpu`, if the platform allows.
+void PinToCpu(std::thread& thread, int cpu) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  // A CPU that doesn't exist (or isn't ours) just leaves the thread unpinned.
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+}
 }  // namespace
 
 namespace fs = std::filesystem;
 
-std::streamoff Bitcask::CaskEntry::ValueOffset() {
+struct Bitcask::SnapshotState {
+  // The live entries of the in-memory part of the KeyDir.
+  std::unordered_map<std::string, KeyDirEntry> entries;
+  // A copy of the spill index's slots and file table. Spilled keys aren't
+  // copied: like `SpillIndex::Find`, lookups confirm them against the cask
+  // files, which never change (and which `retired` keeps around).
+  std::vector<SpillIndex::Slot> spilled;
+  std::vector<std::string> spilled_file_ids;
+  DictionaryMap dictionaries;
+  // When the snapshot was taken, which spilled entries are expired as of.
+  int64_t taken_at;
+  // The Bitcask's `writes_` when the snapshot was taken, and when its next
+  // entry expires: until either changes, later snapshots can share this one.
+  uint64_t writes;
+  int64_t valid_until = INT64_MAX;
+  // Files the entries may point into that have since been merged away. Only
+  // ever added to by the Bitcask's writer.
+  std::vector<std::shared_ptr<RetiredFiles>> retired;
+
+  KeyDirEntry FromSlot(const SpillIndex::Slot& slot) const {
+    return {
+        .file_id = spilled_file_ids[slot.file_index],
+        .value_sz = slot.value_sz,
+        .codec = slot.codec,
+        .value_pos = std::streamoff(slot.value_pos),
+        .timestamp = slot.timestamp,
+        .expiry = slot.expiry,
+    };
+  }
+
+  bool IsLive(const SpillIndex::Slot& slot) const {
+    return slot.occupied && (slot.expiry == 0 || slot.expiry > taken_at);
+  }
+
+  // Returns the live entry of `key`, or nullopt.
+  std::optional<KeyDirEntry> Find(const std::string& key) const;
+
+  // Calls `fn(key, entry, input)` for every live entry in file order, with
+  // `input` positioned at the entry's value.
+  template <typename Fn>
+  void ForEachInFileOrder(Fn fn) const;
+};
+
+void BitcaskStats::Merge(const BitcaskStats& other) {
+  put_latency.Merge(other.put_latency);
+  get_latency.Merge(other.get_latency);
+  delete_latency.Merge(other.delete_latency);
+  flush_latency.Merge(other.flush_latency);
+  file_open_latency.Merge(other.file_open_latency);
+  get_hits += other.get_hits;
+  get_misses += other.get_misses;
+  bytes_written += other.bytes_written;
+  bytes_read += other.bytes_read;
+  value_cache_hits += other.value_cache_hits;
+  keydir_entries += other.keydir_entries;
+  keydir_spilled_entries += other.keydir_spilled_entries;
+  keydir_memory_bytes += other.keydir_memory_bytes;
+  cask_files += other.cask_files;
+  live_bytes += other.live_bytes;
+  dead_bytes += other.dead_bytes;
+  active_file_bytes += other.active_file_bytes;
+  value_cache_bytes += other.value_cache_bytes;
+}
+
+std::string BitcaskStats::ToString() const {
+  std::stringstream ss;
+  ss << "put_latency_ns: " << put_latency.ToString() << "\n"
+     << "get_latency_ns: " << get_latency.ToString() << "\n"
+     << "delete_latency_ns: " << delete_latency.ToString() << "\n"
+     << "flush_latency_ns: " << flush_latency.ToString() << "\n"
+     << "file_open_latency_ns: " << file_open_latency.ToString() << "\n"
+     << "get_hits: " << get_hits << "\n"
+     << "get_misses: " << get_misses << "\n"
+     << "bytes_written: " << bytes_written << "\n"
+     << "bytes_read: " << bytes_read << "\n"
+     << "value_cache_hits: " << value_cache_hits << "\n"
+     << "keydir_entries: " << keydir_entries << "\n"
+     << "keydir_spilled_entries: " << keydir_spilled_entries << "\n"
+     << "keydir_memory_bytes: " << keydir_memory_bytes << "\n"
+     << "cask_files: " << cask_files << "\n"
+     << "live_bytes: " << live_bytes << "\n"
+     << "dead_bytes: " << dead_bytes << "\n"
+     << "active_file_bytes: " << active_file_bytes << "\n"
+     << "value_cache_bytes: " << value_cache_bytes << "\n";
+  return ss.str();
+}
+
+std::string BitcaskStats::ToPrometheusText() const {
+  std::stringstream ss;
+  WriteMetric(ss, "bitcask_gets_total", "counter", "Get calls.",
+              get_latency.count());
+  WriteMetric(ss, "bitcask_get_hits_total", "counter",
+              "Get calls that found their key.", get_hits);
+  WriteMetric(ss, "bitcask_get_misses_total", "counter",
+              "Get calls that didn't find their key.", get_misses);
+  WriteMetric(ss, "bitcask_puts_total", "counter", "Put calls.",
+              put_latency.count());
+  WriteMetric(ss, "bitcask_deletes_total", "counter", "Delete calls.",
+              delete_latency.count());
+  WriteMetric(ss, "bitcask_written_bytes_total", "counter",
+              "Bytes appended to cask files.", bytes_written);
+  WriteMetric(ss, "bitcask_read_bytes_total", "counter",
+              "Bytes read from cask files by Get.", bytes_read);
+  WriteMetric(ss, "bitcask_flushes_total", "counter",
+              "Flushes of the active file.", flush_latency.count());
+  WriteMetric(ss, "bitcask_files_opened_total", "counter",
+              "Cask files opened.", file_open_latency.count());
+  WriteMetric(ss, "bitcask_value_cache_hits_total", "counter",
+              "Get calls answered by the value cache.", value_cache_hits);
+  WriteMetric(ss, "bitcask_keydir_entries", "gauge", "Keys in the KeyDir.",
+              keydir_entries);
+  WriteMetric(ss, "bitcask_keydir_spilled_entries", "gauge",
+              "Keys in the KeyDir's on-disk spill index.",
+              keydir_spilled_entries);
+  WriteMetric(ss, "bitcask_keydir_memory_bytes", "gauge",
+              "Estimated heap bytes used by the KeyDir.",
+              keydir_memory_bytes);
+  WriteMetric(ss, "bitcask_cask_files", "gauge",
+              "Cask files, including the active one.", cask_files);
+  WriteMetric(ss, "bitcask_live_bytes", "gauge",
+              "Bytes on disk referenced by the KeyDir.", live_bytes);
+  WriteMetric(ss, "bitcask_dead_bytes", "gauge",
+              "Bytes on disk a merge would reclaim.", dead_bytes);
+  WriteMetric(ss, "bitcask_active_file_bytes", "gauge",
+              "Size of the file being appended to.", active_file_bytes);
+  WriteMetric(ss, "bitcask_value_cache_bytes", "gauge",
+              "Bytes held by the value cache.", value_cache_bytes);
+  WriteSummary(ss, "bitcask_put_latency_seconds", "Put latency.",
+               put_latency);
+  WriteSummary(ss, "bitcask_get_latency_seconds", "Get latency.",
+               get_latency);
+  WriteSummary(ss, "bitcask_delete_latency_seconds", "Delete latency.",
+               delete_latency);
+  WriteSummary(ss, "bitcask_flush_latency_seconds",
+               "Latency of flushing the active file.", flush_latency);
+  WriteSummary(ss, "bitcask_file_open_latency_seconds",
+               "Latency of opening cask files.", file_open_latency);
+  return ss.str();
+}
+
+void Bitcask::CaskEntry::SerializeHeaderAndKey(std::string* output) const {
+  auto append = [output](const auto& field) {
+    output->append(reinterpret_cast<const char*>(&field), sizeof(field));
+  };
+  append(timestamp);
+  append(expiry);
+  append(key_sz);
+  append(value_sz);
+  append(flags);
+  append(codec);
+  output->append(key);
+}
+
+std::streamoff Bitcask::CaskEntry::HeaderSize() {
   // TODO: CRC.
-  return std::streamoff(sizeof(timestamp)) + std::streamoff(sizeof(key_sz)) +
-         std::streamoff(sizeof(value_sz)) + std::streamoff(key.size());
+  return std::streamoff(sizeof(timestamp)) + std::streamoff(sizeof(expiry)) +
+         std::streamoff(sizeof(key_sz)) +
+         std::streamoff(sizeof(value_sz)) + std::streamoff(sizeof(flags)) +
+         std::streamoff(sizeof(codec));
+}
+
+std::streamoff Bitcask::CaskEntry::ValueOffset() {
+  return HeaderSize() + std::streamoff(key.size());
 }
 
 // Note that reading/writing the data is not platform-independent and may
@@ -83,154 +368,1653 @@ std::istream& operator>>(std::istream& input, Bitcask::CaskEntry& cask_entry) {
   // calls, but it would ruin the single-line approach below (appearance always
   // trumps performance).
   ReadToTarget(input, &cask_entry.timestamp);
+  ReadToTarget(input, &cask_entry.expiry);
   ReadToTarget(input, &cask_entry.key_sz);
   ReadToTarget(input, &cask_entry.value_sz);
+  ReadToTarget(input, &cask_entry.flags);
+  ReadToTarget(input, &cask_entry.codec);
   ReadToTarget(input, &cask_entry.key, cask_entry.key_sz);
   ReadToTarget(input, &cask_entry.value, cask_entry.value_sz);
 
   return input;
 }
 
-// Serializes `cask_entry` to `output`.
-std::ostream& operator<<(std::ostream& output, Bitcask::CaskEntry& cask_entry) {
-  WriteToTarget(output, &cask_entry.timestamp);
-  WriteToTarget(output, &cask_entry.key_sz);
-  WriteToTarget(output, &cask_entry.value_sz);
+std::istream& Bitcask::ReadEntrySkippingValue(std::istream& input,
+                                              CaskEntry& cask_entry) {
+  ReadToTarget(input, &cask_entry.timestamp);
+  ReadToTarget(input, &cask_entry.expiry);
+  ReadToTarget(input, &cask_entry.key_sz);
+  ReadToTarget(input, &cask_entry.value_sz);
+  ReadToTarget(input, &cask_entry.flags);
+  ReadToTarget(input, &cask_entry.codec);
+  ReadToTarget(input, &cask_entry.key, cask_entry.key_sz);
+  if (cask_entry.IsDictionary()) {
+    ReadToTarget(input, &cask_entry.value, cask_entry.value_sz);
+    return input;
+  }
+  cask_entry.value.clear();
+  SkipBytes(input, cask_entry.value_sz);
+
+  return input;
+}
 
-  output << cask_entry.key;
+// Serializes `cask_entry` to `output`. The layout is `SerializeHeaderAndKey`'s,
+// so merged files match what `Append` writes.
+std::ostream& operator<<(std::ostream& output, Bitcask::CaskEntry& cask_entry) {
+  std::string header_and_key;
+  cask_entry.SerializeHeaderAndKey(&header_and_key);
+  output << header_and_key;
   output << cask_entry.value;
 
   return output;
 }
 
-Bitcask Bitcask::Open(const std::string& directory_name) {
+Bitcask Bitcask::Open(const std::string& directory_name,
+                      const Options& options) {
+  TraceSink* tracer = options.trace_sink.get();
+  ScopedSpan open_span(tracer, "Open");
   fs::path cask_path(directory_name);
 
+  if (options.ordered_index &&
+      options.keydir_full_policy == KeyDirFullPolicy::kSpill) {
+    throw std::invalid_argument(
+        "An ordered index can't be combined with a spilling KeyDir");
+  }
+
   if (!fs::exists(cask_path)) {
     fs::create_directory(cask_path);
   }
 
   // Read all .cask files to build the KeyDir.
-  rd::bitcask::Bitcask::KeyDirMap key_dir;
-  for (const auto& file_entry : fs::directory_iterator(cask_path)) {
-    if (file_entry.path().extension() != kCaskSuffix) {
-      continue;
+  LoadedCask loaded;
+  KeyDirMap& key_dir = loaded.key_dir;
+  // Timestamps of the most recent deletion (or expired write) of each deleted
+  // key. Files are visited in no particular order, so without these an older
+  // value read after its tombstone would be resurrected.
+  std::unordered_map<std::string, int64_t> tombstones;
+  const int64_t now = NowToMicros();
+  const size_t budget = options.keydir_memory_budget;
+  const bool spill = options.keydir_full_policy == KeyDirFullPolicy::kSpill;
+  SpillReader spill_reader;
+
+  std::vector<fs::path> cask_file_paths;
+  {
+    ScopedSpan span(tracer, "Open.ScanDirectory");
+    for (const auto& file_entry : fs::directory_iterator(cask_path)) {
+      if (file_entry.path().extension() == kMergingSuffix ||
+          file_entry.path().extension() == kSpillSuffix) {
+        fs::remove(file_entry.path());
+      } else if (file_entry.path().extension() == kCaskSuffix) {
+        cask_file_paths.push_back(file_entry.path());
+      }
     }
+  }
 
-    const fs::path& cask_file_path = file_entry.path();
+  // Entries are merged into the KeyDir as each file is read, so the time spent
+  // doing so is part of each file's span.
+  for (const fs::path& cask_file_path : cask_file_paths) {
+    ScopedSpan span(tracer, "Open.ScanFile");
+    if (span.enabled()) {
+      span.set_detail(cask_file_path);
+    }
+    auto open_start = std::chrono::steady_clock::now();
     std::ifstream cask_file(cask_file_path, std::ios::binary);
+    loaded.file_open_latency.Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - open_start)
+            .count());
 
     std::streampos entry_start;
     CaskEntry entry;
-    while (entry_start = cask_file.tellg(), cask_file >> entry) {
+    while (entry_start = cask_file.tellg(),
+           ReadEntrySkippingValue(cask_file, entry)) {
+      // Real entries always have a timestamp; zeros are the block padding
+      // of a file written with direct I/O that was never closed.
+      if (entry.timestamp == 0) {
+        break;
+      }
+      loaded.last_timestamp = std::max(loaded.last_timestamp, entry.timestamp);
+      if (entry.IsDictionary()) {
+        loaded.dictionaries[cask_file_path] =
+            std::make_unique<LzDictCodec>(std::move(entry.value));
+        continue;
+      }
+
       // Skip outdated entries.
       auto existing_key = key_dir.find(entry.key);
-      if (existing_key != key_dir.end() &&
-          existing_key->second.timestamp >= entry.timestamp) {
+      SpillIndex::Slot* spilled = nullptr;
+      if (existing_key == key_dir.end() && loaded.spill != nullptr) {
+        spilled = FindSpilled(*loaded.spill, entry.key, spill_reader);
+      }
+      if ((existing_key != key_dir.end() &&
+           existing_key->second.timestamp >= entry.timestamp) ||
+          (spilled != nullptr && spilled->timestamp >= entry.timestamp)) {
+        continue;
+      }
+      auto tombstone = tombstones.find(entry.key);
+      if (tombstone != tombstones.end() &&
+          tombstone->second >= entry.timestamp) {
         continue;
       }
 
       // Prune tombstoned entities. Note that this reflects the true order of
       // operations - if an entry exists, this removes it but a subsequent
-      // operation is free to re-add it.
-      if (entry.value == kTombstoneValue) {
-        key_dir.erase(entry.key);
+      // operation is free to re-add it. Expired entries act as tombstones
+      // too - they shadow whatever was written before them.
+      if (entry.IsTombstone() || (entry.expiry != 0 && entry.expiry <= now)) {
+        if (spilled != nullptr) {
+          loaded.spill->Erase(spilled);
+        } else if (existing_key != key_dir.end()) {
+          key_dir.erase(existing_key);
+        }
+        tombstones[entry.key] = entry.timestamp;
         continue;
       }
 
-      key_dir[entry.key] = {
+      KeyDirEntry key_dir_entry = {
           .file_id = cask_file_path,
           .value_sz = entry.value_sz,
+          .codec = entry.codec,
           .value_pos = entry_start + entry.ValueOffset(),
           .timestamp = entry.timestamp,
+          .expiry = entry.expiry,
       };
+      if (spilled != nullptr) {
+        ToSlot(*loaded.spill, key_dir_entry, entry.key_sz, spilled);
+        continue;
+      }
+      if (existing_key != key_dir.end()) {
+        existing_key->second = std::move(key_dir_entry);
+        continue;
+      }
+      key_dir.emplace(entry.key, std::move(key_dir_entry));
+
+      // Only the nodes and buckets are checked here, which is cheap enough to
+      // do per key; the constructor checks the full figure.
+      if (budget != 0 && key_dir.get_allocator().allocated_bytes() > budget) {
+        if (!spill) {
+          throw KeyDirFullException("KeyDir of " + directory_name +
+                                    " doesn't fit in its memory budget");
+        }
+        EvictColdEntries(
+            key_dir, SpillIndexIn(loaded.spill, cask_path), &loaded.clock_hand,
+            [&] {
+              return key_dir.get_allocator().allocated_bytes() <=
+                     budget - budget / 16;
+            },
+            [](const auto&) {});
+      }
     }
+    loaded.file_usage[cask_file_path].total_bytes =
+        fs::file_size(cask_file_path);
   }
 
   // A new file is always created on startup. For now, just use the timestamp
   // as an identifier.
   std::string ts = std::to_string(NowToMicros());
   fs::path db_path = cask_path / ts.append(kCaskSuffix);
-  return Bitcask(db_path, key_dir);
+  return Bitcask(db_path, std::move(loaded), options);
 }
 
-Bitcask::Bitcask(fs::path path, KeyDirMap key_dir)
-    : db_path_(std::move(path)), key_dir_(std::move(key_dir)) {
-  // 💡: opening in `out` without `app` truncates the file.
-  f_ = std::make_unique<std::ofstream>(db_path_,
-                                       std::ios::binary | std::ios::trunc);
+Bitcask::Bitcask(fs::path path, LoadedCask loaded, Options options)
+    : options_(std::move(options)),
+      db_path_(std::move(path)),
+      key_dir_(std::move(loaded.key_dir)),
+      ordered_keys_(key_dir_.get_allocator()),
+      dictionaries_(std::move(loaded.dictionaries)),
+      file_usage_(std::move(loaded.file_usage)),
+      spill_(std::move(loaded.spill)),
+      clock_hand_(loaded.clock_hand),
+      last_timestamp_(loaded.last_timestamp) {
+  if (options_.value_cache_bytes != 0) {
+    value_cache_ = std::make_unique<ValueCache>(options_.value_cache_bytes);
+  }
+  latencies_.file_open.Merge(loaded.file_open_latency);
+  {
+    ScopedSpan span(tracer(), "Open.TrackKeyDir");
+    file_usage_[db_path_] = {};
+    for (const auto& element : key_dir_) {
+      TrackEntry(element);
+      IndexKey(element);
+    }
+    for (size_t i = 0; spill_ != nullptr && i < spill_->capacity(); ++i) {
+      if (spill_->slot(i).occupied) {
+        TrackSpilled(spill_->slot(i));
+      }
+    }
+  }
+  if (options_.keydir_memory_budget != 0 &&
+      KeyDirMemory() > options_.keydir_memory_budget &&
+      !(options_.keydir_full_policy == KeyDirFullPolicy::kSpill &&
+        SpillForSpace(0))) {
+    throw KeyDirFullException("KeyDir of " +
+                              db_path_.parent_path().string() +
+                              " doesn't fit in its memory budget");
+  }
+
+  OpenActiveFile();
+
+  if (options_.writer_thread) {
+    writer_ = std::make_unique<Writer>();
+    writer_->thread = std::thread(&Bitcask::RunWriter, this);
+    if (options_.writer_cpu >= 0) {
+      PinToCpu(writer_->thread, options_.writer_cpu);
+    }
+  }
+}
+
+Bitcask::~Bitcask() {
+  // Async operations may still be queued, and may need the writer thread.
+  executor_.reset();
+  if (writer_ != nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(writer_->wake_mu);
+      writer_->stop.store(true);
+    }
+    writer_->wake.notify_one();
+    writer_->thread.join();
+  }
+  try {
+    CloseActiveFile();
+  } catch (const std::system_error&) {
+    // Nowhere to report it; every write acknowledged was already flushed.
+  }
 }
 
-Bitcask::~Bitcask() { f_->flush(); }
+void Bitcask::OpenActiveFile() {
+  ScopedLatency latency(latencies_.file_open);
+  if (options_.direct_io) {
+    f_ = std::make_unique<DirectFileWriter>(db_path_);
+  } else {
+    f_ = std::make_unique<BufferedFileWriter>(db_path_);
+  }
+  preallocate_ = options_.preallocate_bytes != 0;
+  preallocated_bytes_ = 0;
+}
 
-void Bitcask::Put(const std::string& key, std::string value) {
-  int64_t time_us = NowToMicros();
+void Bitcask::CloseActiveFile() { f_->Close(); }
+
+void Bitcask::Preallocate(uint64_t end) {
+#ifdef __linux__
+  if (!preallocate_ || end <= preallocated_bytes_) {
+    return;
+  }
+  ScopedSpan span(tracer(), "Append.Preallocate");
+  uint64_t extent = std::max<uint64_t>(options_.preallocate_bytes,
+                                       end - preallocated_bytes_);
+  // 💡: `FALLOC_FL_KEEP_SIZE` reserves the blocks without moving the end
+  // of the file, so readers (and `Open`) never see the unwritten tail.
+  if (fallocate(f_->fd(), FALLOC_FL_KEEP_SIZE, preallocated_bytes_, extent) !=
+      0) {
+    // Not supported here (or out of space, which the write will report):
+    // carry on appending the usual way.
+    preallocate_ = false;
+    return;
+  }
+  preallocated_bytes_ += extent;
+#endif
+}
 
-  size_t value_size = value.length();
+void Bitcask::SealActiveFile() {
+  CloseActiveFile();
+  fs::path sealed_path = db_path_;
+  // Two files created within the same microsecond would share a name.
+  do {
+    std::string ts = std::to_string(NowToMicros());
+    db_path_ = sealed_path.parent_path() / ts.append(kCaskSuffix);
+  } while (db_path_ == sealed_path);
+  file_usage_[db_path_] = {};
+  OpenActiveFile();
+}
+
+void Bitcask::Checkpoint(const std::string& directory_name) {
+  ScopedSpan span(tracer(), "Checkpoint");
+  auto lock = WriteLock();
+  fs::path checkpoint_path(directory_name);
+  if (!fs::create_directories(checkpoint_path)) {
+    throw std::invalid_argument("Checkpoint directory " + directory_name +
+                                " already exists");
+  }
+  // An empty active file has nothing to preserve.
+  if (file_usage_.at(db_path_).total_bytes != 0) {
+    SealActiveFile();
+  }
 
+  std::stringstream manifest;
+  for (const auto& [file_id, usage] : file_usage_) {
+    if (file_id == db_path_.native()) {
+      continue;
+    }
+    fs::path source(file_id);
+    fs::path target = checkpoint_path / source.filename();
+    // A link shares the file's (possibly unwritten) pages, so they have to
+    // reach disk first. It's cheap for files synced by an earlier checkpoint.
+    SyncPath(source);
+    std::error_code error;
+    fs::create_hard_link(source, target, error);
+    if (error == std::errc::cross_device_link) {
+      fs::copy_file(source, target);
+      SyncPath(target);
+    } else if (error) {
+      throw fs::filesystem_error("Checkpoint", source, target, error);
+    }
+    manifest << source.filename().string() << " " << usage.total_bytes
+             << "\n";
+  }
+
+  // 💡: a rename within a directory is atomic, so once the manifest's
+  // contents are on disk it is either complete or missing, even after a
+  // crash. Syncing the directory (and its parent, which gained it) then makes
+  // the rename and the links durable.
+  fs::path manifest_path = checkpoint_path / kManifestName;
+  fs::path temporary_path = manifest_path;
+  temporary_path += ".tmp";
+  {
+    std::ofstream output(temporary_path, std::ios::trunc);
+    output << manifest.str();
+  }
+  SyncPath(temporary_path);
+  fs::rename(temporary_path, manifest_path);
+  SyncPath(checkpoint_path);
+  SyncPath(fs::absolute(checkpoint_path).parent_path());
+}
+
+std::streampos Bitcask::Append(CaskEntry& cask_entry) {
+  uint64_t& file_bytes = file_usage_[db_path_].total_bytes;
+  std::streampos value_pos = file_bytes + cask_entry.ValueOffset();
+
+  uint64_t entry_size = cask_entry.ValueOffset() + cask_entry.value.size();
+  Preallocate(file_bytes + entry_size);
+  {
+    ScopedSpan span(tracer(), "Append.Write");
+    record_.clear();
+    cask_entry.SerializeHeaderAndKey(&record_);
+    // One unit, so a failed write can't leave half a record behind for the
+    // next one to land after (see `FileWriter::Append`).
+    f_->Append(record_, cask_entry.value);
+  }
+
+  file_bytes += entry_size;
+  counters_.bytes_written.fetch_add(entry_size, std::memory_order_relaxed);
+
+  return value_pos;
+}
+
+void Bitcask::Flush() {
+  ScopedSpan span(tracer(), "Append.Flush");
+  ScopedLatency latency(latencies_.flush);
+  f_->Flush();
+}
+
+void Bitcask::EncodeValue(std::string value, CaskEntry& cask_entry) const {
+  cask_entry.value = std::move(value);
+  cask_entry.codec = CodecId::kNone;
+
+  const Codec* codec = GetCodec(options_.compression);
+  if (codec != nullptr &&
+      cask_entry.value.size() >= options_.compression_min_size) {
+    std::string compressed;
+    codec->Compress(cask_entry.value, &compressed);
+    // Incompressible values are kept raw so reads don't pay for nothing.
+    if (compressed.size() < cask_entry.value.size()) {
+      cask_entry.value = std::move(compressed);
+      cask_entry.codec = codec->id();
+    }
+  }
+  cask_entry.value_sz = cask_entry.value.size();
+}
+
+std::string Bitcask::ReadStoredValue(std::istream& input,
+                                     const KeyDirEntry& entry) {
+  input.seekg(entry.value_pos);
+
+  std::string value;
+  ReadToTarget(input, &value, entry.value_sz);
+  return value;
+}
+
+std::string Bitcask::DecodeValue(const DictionaryMap& dictionaries,
+                                 const KeyDirEntry& entry,
+                                 std::string stored) {
+  if (entry.codec == CodecId::kNone) {
+    return stored;
+  }
+
+  const Codec* codec;
+  if (entry.codec == CodecId::kLzDict) {
+    auto dictionary = dictionaries.find(entry.file_id);
+    codec = dictionary == dictionaries.end() ? nullptr
+                                             : dictionary->second.get();
+  } else {
+    codec = GetCodec(entry.codec);
+  }
+  if (codec == nullptr) {
+    throw CorruptValueException("No codec for value in " + entry.file_id);
+  }
+
+  std::string decompressed;
+  codec->Decompress(stored, &decompressed);
+  return decompressed;
+}
+
+void Bitcask::Put(const std::string& key, std::string value) {
+  Put(key, std::move(value), std::chrono::microseconds::zero());
+}
+
+void Bitcask::Put(const std::string& key, std::string value,
+                  std::chrono::microseconds ttl) {
+  ScopedSpan span(tracer(), "Put");
+  ScopedLatency latency(latencies_.put);
   CaskEntry cask_entry;
-  cask_entry.timestamp = time_us;
-  cask_entry.key_sz = key.length();
-  cask_entry.value_sz = value_size;
-  cask_entry.key = key;
-  cask_entry.value = value;
+  {
+    ScopedSpan encode_span(tracer(), "Put.Encode");
+    cask_entry.key_sz = key.length();
+    cask_entry.key = key;
+    EncodeValue(std::move(value), cask_entry);
+  }
+
+  if (writer_ != nullptr) {
+    // 💡: compression is the expensive part of a Put, and it's done here
+    // (in parallel across callers) rather than on the writer thread.
+    WriteRequest request = {.cask_entry = std::move(cask_entry), .ttl = ttl};
+    Submit(request);
+    return;
+  }
+  PutEntry(cask_entry, ttl);
+  Flush();
+}
 
-  // Calculate the value offset before writing the entry (which will advance
-  // the position).
-  auto value_pos = f_->tellp() + cask_entry.ValueOffset();
+void Bitcask::PutEntry(CaskEntry& cask_entry, std::chrono::microseconds ttl) {
+  const std::string& key = cask_entry.key;
+  // A spilled key comes back into memory with its new value. Only if there's
+  // no room for it, even after spilling others, is it updated where it is.
+  SpillIndex::Slot* spilled = nullptr;
+  if (!ReserveKeyDirMemory(key)) {
+    if (spill_ != nullptr) {
+      SpillReader reader;
+      spilled = FindSpilled(*spill_, key, reader);
+    }
+    if (spilled == nullptr) {
+      throw KeyDirFullException("No room in the KeyDir for key '" + key +
+                                "'");
+    }
+  }
+  int64_t time_us = NextTimestamp();
+  cask_entry.timestamp = time_us;
+  if (ttl > std::chrono::microseconds::zero()) {
+    cask_entry.expiry = time_us + ttl.count();
+  }
 
-  *f_ << cask_entry;
-  f_->flush();
+  auto value_pos = Append(cask_entry);
+  if (value_cache_ != nullptr) {
+    value_cache_->Erase(key);
+  }
 
-  key_dir_[key] = {
+  ScopedSpan index_span(tracer(), "Put.UpdateKeyDir");
+  ++writes_;
+  KeyDirEntry key_dir_entry = {
       .file_id = db_path_,
-      .value_sz = value_size,
+      .value_sz = cask_entry.value_sz,
+      .codec = cask_entry.codec,
       .value_pos = value_pos,
       .timestamp = time_us,
+      .expiry = cask_entry.expiry,
   };
+  if (spilled != nullptr) {
+    UntrackSpilled(*spilled);
+    ToSlot(*spill_, key_dir_entry, key.size(), spilled);
+    TrackSpilled(*spilled);
+    return;
+  }
+  auto [itr, inserted] = key_dir_.try_emplace(key);
+  if (!inserted) {
+    UntrackEntry(*itr);
+  } else {
+    IndexKey(*itr);
+  }
+  if (inserted && spill_ != nullptr) {
+    EraseSpilled(key);
+  }
+  itr->second = std::move(key_dir_entry);
+  TrackEntry(*itr);
+}
+
+int64_t Bitcask::NextTimestamp() {
+  last_timestamp_ = std::max(NowToMicros(), last_timestamp_ + 1);
+  return last_timestamp_;
 }
 
 std::string Bitcask::Get(const std::string& key) const {
-  auto itr = key_dir_.find(key);
-  if (itr == key_dir_.end()) {
+  ScopedSpan span(tracer(), "Get");
+  ScopedLatency latency(latencies_.get);
+  // When spilling, reads mark entries for the eviction sweep, so they can't
+  // share the lock.
+  std::shared_lock<std::shared_mutex> shared_lock;
+  std::unique_lock<std::shared_mutex> exclusive_lock;
+  if (options_.keydir_full_policy == KeyDirFullPolicy::kSpill) {
+    exclusive_lock = WriteLock();
+  } else {
+    shared_lock = ReadLock();
+  }
+  KeyDirMap::const_iterator itr;
+  {
+    ScopedSpan lookup_span(tracer(), "Get.Lookup");
+    itr = key_dir_.find(key);
+  }
+  if (itr == key_dir_.end() && spill_ != nullptr) {
+    return GetSpilled(key);
+  }
+  if (itr == key_dir_.end() || itr->second.IsExpired(NowToMicros())) {
+    counters_.get_misses.fetch_add(1, std::memory_order_relaxed);
     throw MissingKeyException(key);
     return std::string{};
   }
+  counters_.get_hits.fetch_add(1, std::memory_order_relaxed);
 
   const auto& [entry_key, key_dir_entry] = *itr;
+  if (options_.keydir_full_policy == KeyDirFullPolicy::kSpill) {
+    key_dir_entry.referenced = true;
+  }
+  if (value_cache_ != nullptr) {
+    ScopedSpan cache_span(tracer(), "Get.Cache");
+    std::string cached;
+    if (value_cache_->Lookup(key, &cached)) {
+      counters_.value_cache_hits.fetch_add(1, std::memory_order_relaxed);
+      return cached;
+    }
+  }
+  counters_.bytes_read.fetch_add(key_dir_entry.value_sz,
+                                 std::memory_order_relaxed);
 
   // Load the corresponding file / value.
-  std::ifstream input(key_dir_entry.file_id, std::ios::binary);
-  input.seekg(key_dir_entry.value_pos);
-
-  char value_data[key_dir_entry.value_sz];
-  input.read(value_data, key_dir_entry.value_sz);
-  std::string value(value_data, key_dir_entry.value_sz);
-
+  std::ifstream input;
+  {
+    ScopedSpan open_span(tracer(), "Get.OpenFile");
+    ScopedLatency open_latency(latencies_.file_open);
+    input.open(key_dir_entry.file_id, std::ios::binary);
+  }
+  std::string stored;
+  {
+    ScopedSpan read_span(tracer(), "Get.Read");
+    stored = ReadStoredValue(input, key_dir_entry);
+  }
+  ScopedSpan decode_span(tracer(), "Get.Decode");
+  std::string value = DecodeValue(key_dir_entry, std::move(stored));
+  if (value_cache_ != nullptr) {
+    // 💡: Puts and Deletes invalidate under the exclusive lock, which can't
+    // be taken while this Get holds it shared, so this value can't be stale.
+    value_cache_->Insert(key, value);
+  }
   return value;
 }
 
 void Bitcask::Delete(const std::string& key) {
-  auto itr = key_dir_.find(key);
-  if (itr == key_dir_.end()) {
+  ScopedSpan span(tracer(), "Delete");
+  ScopedLatency latency(latencies_.del);
+  if (writer_ != nullptr) {
+    WriteRequest request;
+    request.cask_entry.key_sz = key.length();
+    request.cask_entry.flags = kTombstoneFlag;
+    request.cask_entry.key = key;
+    Submit(request);
     return;
   }
+  if (DeleteEntry(key)) {
+    Flush();
+  }
+}
+
+bool Bitcask::DeleteEntry(const std::string& key) {
+  auto itr = key_dir_.find(key);
+  SpillIndex::Slot* spilled = nullptr;
+  if (itr == key_dir_.end() && spill_ != nullptr) {
+    SpillReader reader;
+    spilled = FindSpilled(*spill_, key, reader);
+  }
+  if (itr == key_dir_.end() && spilled == nullptr) {
+    return false;
+  }
 
-  // Tombstone the entry so it is cleared on the next merge.
-  Put(key, std::string(kTombstoneValue));
+  // Tombstone the entry so it is cleared on the next merge. Only the header
+  // and key are written; the flag alone marks the deletion.
+  CaskEntry cask_entry;
+  cask_entry.timestamp = NextTimestamp();
+  cask_entry.key_sz = key.length();
+  cask_entry.flags = kTombstoneFlag;
+  cask_entry.key = key;
+  Append(cask_entry);
+  if (value_cache_ != nullptr) {
+    value_cache_->Erase(key);
+  }
 
   // Remove from the KeyDir so Get()'s fail.
-  key_dir_.erase(key);
+  ++writes_;
+  if (spilled != nullptr) {
+    EraseSpilledSlot(spilled);
+    return true;
+  }
+  UntrackEntry(*itr);
+  UnindexKey(*itr);
+  key_dir_.erase(itr);
+  return true;
+}
+
+void Bitcask::Submit(WriteRequest& request) {
+  Writer& writer = *writer_;
+  if (writer.failed.load(std::memory_order_acquire)) {
+    std::rethrow_exception(writer.failure);
+  }
+  while (!writer.queue.TryPush(&request)) {
+    std::this_thread::yield();
+  }
+  // 💡: pairs with the fence in `RunWriter`. Either the writer sees this
+  // request on its last look before sleeping, or this sees it asleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (writer.sleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(writer.wake_mu);
+    writer.wake.notify_one();
+  }
+
+  std::unique_lock<std::mutex> lock(writer.done_mu);
+  writer.done.wait(lock, [&] { return request.done; });
+  if (request.error != nullptr) {
+    std::rethrow_exception(request.error);
+  }
+}
+
+void Bitcask::RunWriter() {
+  Writer& writer = *writer_;
+  std::vector<WriteRequest*> batch;
+  batch.reserve(Writer::kMaxBatch);
+  for (;;) {
+    WriteRequest* request;
+    while (batch.size() < Writer::kMaxBatch && writer.queue.TryPop(&request)) {
+      batch.push_back(request);
+    }
+    if (!batch.empty()) {
+      ApplyBatch(batch);
+      batch.clear();
+      continue;
+    }
+    if (writer.stop.load()) {
+      return;
+    }
+
+    // Holding `wake_mu` from before `sleeping` is set until the wait
+    // releases it means a submitter's notify can't slip in between.
+    std::unique_lock<std::mutex> lock(writer.wake_mu);
+    writer.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer.queue.Empty() && !writer.stop.load()) {
+      writer.wake.wait(lock);
+    }
+    writer.sleeping.store(false, std::memory_order_relaxed);
+  }
+}
+
+void Bitcask::ApplyBatch(const std::vector<WriteRequest*>& batch) {
+  ScopedSpan span(tracer(), "ApplyBatch");
+  Writer& writer = *writer_;
+  {
+    auto lock = WriteLock();
+    // Requests queued before an earlier batch failed aren't applied either.
+    if (writer.failure == nullptr) {
+      for (WriteRequest* request : batch) {
+        try {
+          if (request->cask_entry.IsTombstone()) {
+            DeleteEntry(request->cask_entry.key);
+          } else {
+            PutEntry(request->cask_entry, request->ttl);
+          }
+        } catch (...) {
+          request->error = std::current_exception();
+        }
+      }
+      try {
+        // 💡: group commit - the whole batch shares one flush.
+        Flush();
+      } catch (...) {
+        writer.failure = std::current_exception();
+        writer.failed.store(true, std::memory_order_release);
+      }
+    }
+    if (writer.failure != nullptr) {
+      for (WriteRequest* request : batch) {
+        if (request->error == nullptr) {
+          request->error = writer.failure;
+        }
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(writer.done_mu);
+    for (WriteRequest* request : batch) {
+      request->done = true;
+    }
+  }
+  writer.done.notify_all();
+}
+
+#ifdef RD_BITCASK_HAS_COROUTINES
+AsyncResult<std::string> Bitcask::GetAsync(std::string key) const {
+  return AsyncResult<std::string>(
+      Executor(), [this, key = std::move(key)] { return Get(key); });
+}
+
+AsyncResult<void> Bitcask::PutAsync(std::string key, std::string value,
+                                    std::chrono::microseconds ttl) {
+  return AsyncResult<void>(Executor(), [this, key = std::move(key),
+                                        value = std::move(value),
+                                        ttl]() mutable {
+    Put(key, std::move(value), ttl);
+  });
+}
+
+AsyncResult<void> Bitcask::DeleteAsync(std::string key) {
+  return AsyncResult<void>(Executor(),
+                           [this, key = std::move(key)] { Delete(key); });
+}
+#endif  // RD_BITCASK_HAS_COROUTINES
+
+IoExecutor& Bitcask::Executor() const {
+  std::call_once(executor_started_, [&] {
+    executor_ = std::make_unique<IoExecutor>(
+        writer_ != nullptr ? std::max<size_t>(1, options_.io_threads) : 1);
+  });
+  return *executor_;
+}
+
+std::shared_lock<std::shared_mutex> Bitcask::ReadLock() const {
+  if (writer_ == nullptr) {
+    return std::shared_lock<std::shared_mutex>(mu_, std::defer_lock);
+  }
+  return std::shared_lock<std::shared_mutex>(mu_);
+}
+
+std::unique_lock<std::shared_mutex> Bitcask::WriteLock() const {
+  if (writer_ == nullptr) {
+    return std::unique_lock<std::shared_mutex>(mu_, std::defer_lock);
+  }
+  return std::unique_lock<std::shared_mutex>(mu_);
 }
 
 std::vector<std::string> Bitcask::ListKeys() const {
+  auto lock = ReadLock();
   std::vector<std::string> keys;
-  keys.reserve(key_dir_.size());
+  keys.reserve(key_dir_.size() + (spill_ == nullptr ? 0 : spill_->size()));
 
+  const int64_t now = NowToMicros();
   for (const auto& [key, value] : key_dir_) {
+    if (!value.IsExpired(now)) {
+      keys.push_back(key);
+    }
+  }
+  SpillReader reader;
+  for (size_t i = 0; spill_ != nullptr && i < spill_->capacity(); ++i) {
+    const SpillIndex::Slot& slot = spill_->slot(i);
+    if (slot.occupied && (slot.expiry == 0 || slot.expiry > now)) {
+      keys.push_back(
+          ReadSpilledKey(reader.Stream(*spill_, slot.file_index), slot));
+    }
+  }
+  return keys;
+}
+
+std::vector<std::string> Bitcask::NextKeys(KeyCursor& cursor,
+                                           size_t max_keys) const {
+  using Phase = KeyCursor::Phase;
+  const bool spilling =
+      options_.keydir_full_policy == KeyDirFullPolicy::kSpill;
+  // When spilling, listings register with `listings_`, so they can't share
+  // the lock.
+  std::shared_lock<std::shared_mutex> shared_lock;
+  std::unique_lock<std::shared_mutex> exclusive_lock;
+  if (spilling) {
+    exclusive_lock = WriteLock();
+  } else {
+    shared_lock = ReadLock();
+  }
+  std::vector<std::string> keys;
+  if (cursor.phase_ == Phase::kDone) {
+    return keys;
+  }
+  const int64_t now = NowToMicros();
+
+  // Keys can move from the spill index back into memory, possibly into a
+  // bucket already listed, so the listing hears about each one.
+  if (spilling && cursor.moved_keys_ == nullptr) {
+    cursor.moved_keys_ = std::make_shared<std::vector<std::string>>();
+    listings_.erase(std::remove_if(listings_.begin(), listings_.end(),
+                                   [](const auto& listing) {
+                                     return listing.expired();
+                                   }),
+                    listings_.end());
+    listings_.push_back(cursor.moved_keys_);
+  }
+  if (cursor.moved_keys_ != nullptr) {
+    std::move(cursor.moved_keys_->begin(), cursor.moved_keys_->end(),
+              std::back_inserter(keys));
+    cursor.moved_keys_->clear();
+  }
+
+  if (cursor.phase_ == Phase::kKeyDir) {
+    // Bucket positions only mean something for the table they came from.
+    // It never shrinks, so this can only happen a handful of times.
+    if (cursor.bucket_count_ != key_dir_.bucket_count()) {
+      cursor.position_ = 0;
+      cursor.bucket_count_ = key_dir_.bucket_count();
+    }
+    for (; cursor.position_ < key_dir_.bucket_count() &&
+           keys.size() < max_keys;
+         ++cursor.position_) {
+      for (auto itr = key_dir_.begin(cursor.position_);
+           itr != key_dir_.end(cursor.position_); ++itr) {
+        if (!itr->second.IsExpired(now)) {
+          keys.push_back(itr->first);
+        }
+      }
+    }
+    if (cursor.position_ < key_dir_.bucket_count()) {
+      return keys;
+    }
+    cursor.phase_ = Phase::kSpilled;
+    cursor.position_ = 0;
+  }
+
+  if (cursor.phase_ == Phase::kSpilled && spill_ != nullptr) {
+    // 💡: Redis' SCAN trick. The spill index only ever doubles, which splits
+    // each home slot `h` into `h` and `h` plus the new top bit. Counting up
+    // through the slots with their bits reversed visits those two right after
+    // one another, so slots already visited stay visited across growth.
+    SpillReader reader;
+    do {
+      const size_t mask = spill_->capacity() - 1;
+      const size_t home = cursor.position_ & mask;
+      // Everything whose home is `home` lies in the run of occupied slots
+      // starting there.
+      for (size_t i = home; spill_->slot(i).occupied; i = (i + 1) & mask) {
+        const SpillIndex::Slot& slot = spill_->slot(i);
+        if ((slot.hash & mask) == home &&
+            (slot.expiry == 0 || slot.expiry > now)) {
+          keys.push_back(
+              ReadSpilledKey(reader.Stream(*spill_, slot.file_index), slot));
+        }
+      }
+      cursor.position_ =
+          ReverseBits(ReverseBits(cursor.position_ | ~mask) + 1);
+    } while (cursor.position_ != 0 && keys.size() < max_keys);
+    if (cursor.position_ != 0) {
+      return keys;
+    }
+  }
+  cursor.phase_ = Phase::kDone;
+  cursor.moved_keys_.reset();
+  return keys;
+}
+
+void Bitcask::Fold(const std::function<void(const std::string& key,
+                                            const std::string& value)>& fn)
+    const {
+  ScopedSpan span(tracer(), "Fold");
+  auto lock = ReadLock();
+  std::vector<LiveEntry> live = LiveEntriesInFileOrder(NowToMicros(), {});
+  SequentialReader reader(&latencies_.file_open);
+  std::string key;
+  std::string value;
+  for (const LiveEntry& entry : live) {
+    ReadLiveEntry(entry, reader, &key, &value);
+    fn(key, value);
+  }
+}
+
+BitcaskSnapshot Bitcask::Snapshot() const {
+  ScopedSpan span(tracer(), "Snapshot");
+  // Shared: `Merge`, the only writer of `snapshots_` besides this, holds the
+  // lock exclusively. `snapshots_mu_` keeps concurrent snapshots apart, and
+  // lets the later ones share what the first copies.
+  auto lock = ReadLock();
+  std::lock_guard<std::mutex> snapshots_lock(snapshots_mu_);
+  const int64_t now = NowToMicros();
+  if (!snapshots_.empty()) {
+    auto latest = snapshots_.back().lock();
+    if (latest != nullptr && latest->writes == writes_ &&
+        now < latest->valid_until) {
+      return BitcaskSnapshot(std::move(latest));
+    }
+  }
+
+  ScopedSpan copy_span(tracer(), "Snapshot.Copy");
+  auto state = std::make_shared<SnapshotState>();
+  state->taken_at = now;
+  state->writes = writes_;
+  auto note_expiry = [&](int64_t expiry) {
+    if (expiry > now) {
+      state->valid_until = std::min(state->valid_until, expiry);
+    }
+  };
+  state->entries.reserve(key_dir_.size());
+  for (const auto& [key, entry] : key_dir_) {
+    if (!entry.IsExpired(now)) {
+      state->entries.emplace(key, entry);
+      note_expiry(entry.expiry);
+    }
+  }
+  if (spill_ != nullptr) {
+    // 💡: probing needs the whole table, free slots included, but it's a
+    // fixed 56 bytes a slot - well under what reading back the keys costs.
+    state->spilled.assign(&spill_->slot(0),
+                          &spill_->slot(0) + spill_->capacity());
+    for (const SpillIndex::Slot& slot : state->spilled) {
+      if (slot.occupied) {
+        note_expiry(slot.expiry);
+      }
+    }
+    state->spilled_file_ids = spill_->file_ids();
+  }
+  state->dictionaries = dictionaries_;
+
+  // Forget snapshots that are gone, so `snapshots_` doesn't grow forever.
+  snapshots_.erase(std::remove_if(snapshots_.begin(), snapshots_.end(),
+                                  [](const auto& snapshot) {
+                                    return snapshot.expired();
+                                  }),
+                   snapshots_.end());
+  snapshots_.push_back(state);
+  return BitcaskSnapshot(std::move(state));
+}
+
+std::optional<Bitcask::KeyDirEntry> Bitcask::SnapshotState::Find(
+    const std::string& key) const {
+  auto itr = entries.find(key);
+  if (itr != entries.end()) {
+    return itr->second;
+  }
+  if (spilled.empty()) {
+    return std::nullopt;
+  }
+  const uint64_t hash = SpillIndex::Hash(key);
+  const size_t mask = spilled.size() - 1;
+  for (size_t i = hash & mask; spilled[i].occupied; i = (i + 1) & mask) {
+    const SpillIndex::Slot& slot = spilled[i];
+    if (slot.hash != hash || slot.key_sz != key.size()) {
+      continue;
+    }
+    std::ifstream input(spilled_file_ids[slot.file_index], std::ios::binary);
+    if (ReadSpilledKey(input, slot) == key) {
+      return IsLive(slot) ? std::optional(FromSlot(slot)) : std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+template <typename Fn>
+void Bitcask::SnapshotState::ForEachInFileOrder(Fn fn) const {
+  struct Item {
+    const std::string* file_id;
+    std::streamoff value_pos;
+    // The in-memory entry, or null for the spilled one in `slot`.
+    const std::pair<const std::string, KeyDirEntry>* entry;
+    const SpillIndex::Slot* slot;
+  };
+  std::vector<Item> items;
+  items.reserve(entries.size());
+  for (const auto& entry : entries) {
+    items.push_back({.file_id = &entry.second.file_id,
+                     .value_pos = entry.second.value_pos,
+                     .entry = &entry,
+                     .slot = nullptr});
+  }
+  for (const SpillIndex::Slot& slot : spilled) {
+    if (IsLive(slot)) {
+      items.push_back({.file_id = &spilled_file_ids[slot.file_index],
+                       .value_pos = std::streamoff(slot.value_pos),
+                       .entry = nullptr,
+                       .slot = &slot});
+    }
+  }
+  std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+    return std::tie(*a.file_id, a.value_pos) <
+           std::tie(*b.file_id, b.value_pos);
+  });
+
+  SequentialReader reader(nullptr);
+  for (const Item& item : items) {
+    if (item.entry != nullptr) {
+      fn(item.entry->first, item.entry->second,
+         reader.Seek(*item.file_id, item.value_pos));
+      continue;
+    }
+    // The key immediately precedes the value.
+    std::istream& input =
+        reader.Seek(*item.file_id, item.value_pos - item.slot->key_sz);
+    std::string key;
+    ReadToTarget(input, &key, item.slot->key_sz);
+    fn(key, FromSlot(*item.slot), input);
+  }
+}
+
+Bitcask::RetiredFiles::~RetiredFiles() {
+  for (const auto& path : paths) {
+    // 💡: the error_code overload doesn't throw, which a destructor mustn't.
+    std::error_code error;
+    fs::remove(path, error);
+  }
+}
+
+std::string BitcaskSnapshot::Get(const std::string& key) const {
+  std::optional<Bitcask::KeyDirEntry> entry = state_->Find(key);
+  if (!entry.has_value()) {
+    throw MissingKeyException(key);
+  }
+  std::ifstream input(entry->file_id, std::ios::binary);
+  return Bitcask::DecodeValue(state_->dictionaries, *entry,
+                              Bitcask::ReadStoredValue(input, *entry));
+}
+
+std::vector<std::string> BitcaskSnapshot::ListKeys() const {
+  std::vector<std::string> keys;
+  keys.reserve(state_->entries.size());
+  for (const auto& [key, entry] : state_->entries) {
     keys.push_back(key);
   }
+  // Spilled keys are read back from just before their values, in file order.
+  std::vector<const SpillIndex::Slot*> spilled;
+  for (const SpillIndex::Slot& slot : state_->spilled) {
+    if (state_->IsLive(slot)) {
+      spilled.push_back(&slot);
+    }
+  }
+  std::sort(spilled.begin(), spilled.end(), [](const auto* a, const auto* b) {
+    return std::tie(a->file_index, a->value_pos) <
+           std::tie(b->file_index, b->value_pos);
+  });
+  Bitcask::SequentialReader reader(nullptr);
+  for (const SpillIndex::Slot* slot : spilled) {
+    std::istream& input =
+        reader.Seek(state_->spilled_file_ids[slot->file_index],
+                    std::streamoff(slot->value_pos - slot->key_sz));
+    ReadToTarget(input, &keys.emplace_back(), slot->key_sz);
+  }
   return keys;
 }
 
+void BitcaskSnapshot::Fold(
+    const std::function<void(const std::string& key,
+                             const std::string& value)>& fn) const {
+  std::string stored;
+  state_->ForEachInFileOrder([&](const std::string& key,
+                                 const Bitcask::KeyDirEntry& entry,
+                                 std::istream& input) {
+    ReadToTarget(input, &stored, entry.value_sz);
+    fn(key, Bitcask::DecodeValue(state_->dictionaries, entry,
+                                 std::move(stored)));
+  });
+}
+
+std::vector<Bitcask::LiveEntry> Bitcask::LiveEntriesInFileOrder(
+    int64_t now, const std::string& skip_file_id) const {
+  std::vector<LiveEntry> live;
+  for (auto itr = key_dir_.begin(); itr != key_dir_.end(); ++itr) {
+    const KeyDirEntry& entry = itr->second;
+    if (!entry.IsExpired(now) && entry.file_id != skip_file_id) {
+      live.push_back({.file_id = &entry.file_id,
+                      .value_pos = entry.value_pos,
+                      .timestamp = entry.timestamp,
+                      .expiry = entry.expiry,
+                      .itr = itr});
+    }
+  }
+  for (size_t i = 0; spill_ != nullptr && i < spill_->capacity(); ++i) {
+    const SpillIndex::Slot& slot = spill_->slot(i);
+    if (!slot.occupied || (slot.expiry != 0 && slot.expiry <= now)) {
+      continue;
+    }
+    const std::string& file_id = spill_->file_id(slot.file_index);
+    if (file_id != skip_file_id) {
+      live.push_back({.file_id = &file_id,
+                      .value_pos = std::streamoff(slot.value_pos),
+                      .timestamp = slot.timestamp,
+                      .expiry = slot.expiry,
+                      .itr = key_dir_.end(),
+                      .slot = i});
+    }
+  }
+  std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) {
+    return std::tie(*a.file_id, a.value_pos) <
+           std::tie(*b.file_id, b.value_pos);
+  });
+  return live;
+}
+
+std::istream& Bitcask::SequentialReader::Seek(const std::string& file_id,
+                                              std::streamoff pos) {
+  if (file_id != file_id_) {
+    std::optional<ScopedLatency> latency;
+    if (file_open_latency_ != nullptr) {
+      latency.emplace(*file_open_latency_);
+    }
+    input_ = std::ifstream(file_id, std::ios::binary);
+    file_id_ = file_id;
+  }
+  // Reads in file order mostly skip short gaps (headers, overwritten values),
+  // which `SkipBytes` does without throwing away the stream's buffer.
+  input_.clear();
+  std::streamoff current = input_.tellg();
+  if (pos >= current) {
+    SkipBytes(input_, pos - current);
+  } else {
+    input_.seekg(pos);
+  }
+  return input_;
+}
+
+void Bitcask::ReadLiveEntry(const LiveEntry& live, SequentialReader& reader,
+                            std::string* key, std::string* value) const {
+  KeyDirEntry spilled;
+  const KeyDirEntry* entry = &spilled;
+  std::istream* input;
+  if (live.itr != key_dir_.end()) {
+    entry = &live.itr->second;
+    *key = live.itr->first;
+    input = &reader.Seek(*live.file_id, live.value_pos);
+  } else {
+    // The key immediately precedes the value.
+    const SpillIndex::Slot& slot = spill_->slot(live.slot);
+    spilled = FromSlot(*spill_, slot);
+    input = &reader.Seek(*live.file_id, live.value_pos - slot.key_sz);
+    ReadToTarget(*input, key, slot.key_sz);
+  }
+  std::string stored;
+  ReadToTarget(*input, &stored, entry->value_sz);
+  *value = DecodeValue(*entry, std::move(stored));
+}
+
+std::vector<std::string> Bitcask::Scan(std::string_view start,
+                                       std::string_view end,
+                                       size_t max_keys) const {
+  auto lock = ReadLock();
+  CheckOrderedIndex();
+  std::vector<std::string> keys;
+  const int64_t now = NowToMicros();
+  for (auto itr = ordered_keys_.lower_bound(start);
+       itr != ordered_keys_.end() && (*itr)->first < end &&
+       keys.size() < max_keys;
+       ++itr) {
+    if (!(*itr)->second.IsExpired(now)) {
+      keys.push_back((*itr)->first);
+    }
+  }
+  return keys;
+}
+
+std::vector<std::string> Bitcask::PrefixScan(std::string_view prefix) const {
+  auto lock = ReadLock();
+  CheckOrderedIndex();
+  std::vector<std::string> keys;
+  const int64_t now = NowToMicros();
+  for (auto itr = ordered_keys_.lower_bound(prefix);
+       itr != ordered_keys_.end() &&
+       (*itr)->first.compare(0, prefix.size(), prefix) == 0;
+       ++itr) {
+    if (!(*itr)->second.IsExpired(now)) {
+      keys.push_back((*itr)->first);
+    }
+  }
+  return keys;
+}
+
+void Bitcask::CheckOrderedIndex() const {
+  if (!options_.ordered_index) {
+    throw std::logic_error("Scans need Options::ordered_index");
+  }
+}
+
+BitcaskStats Bitcask::Stats() const {
+  auto lock = ReadLock();
+  BitcaskStats stats = {
+      .put_latency = latencies_.put.Snapshot(),
+      .get_latency = latencies_.get.Snapshot(),
+      .delete_latency = latencies_.del.Snapshot(),
+      .flush_latency = latencies_.flush.Snapshot(),
+      .file_open_latency = latencies_.file_open.Snapshot(),
+      .get_hits = counters_.get_hits.load(std::memory_order_relaxed),
+      .get_misses = counters_.get_misses.load(std::memory_order_relaxed),
+      .bytes_written = counters_.bytes_written.load(std::memory_order_relaxed),
+      .bytes_read = counters_.bytes_read.load(std::memory_order_relaxed),
+      .value_cache_hits =
+          counters_.value_cache_hits.load(std::memory_order_relaxed),
+      .keydir_entries = key_dir_.size(),
+      .keydir_spilled_entries = spill_ == nullptr ? 0 : spill_->size(),
+      .keydir_memory_bytes = KeyDirMemory(),
+      .cask_files = file_usage_.size(),
+  };
+  stats.keydir_entries += stats.keydir_spilled_entries;
+  for (const auto& [file_id, usage] : file_usage_) {
+    stats.live_bytes += usage.live_bytes;
+    stats.dead_bytes += usage.total_bytes - usage.live_bytes;
+  }
+  stats.active_file_bytes = file_usage_.at(db_path_).total_bytes;
+  stats.value_cache_bytes =
+      value_cache_ == nullptr ? 0 : value_cache_->size_bytes();
+  return stats;
+}
+
+size_t Bitcask::KeyDirMemory() const {
+  return key_dir_.get_allocator().allocated_bytes() + key_dir_string_bytes_;
+}
+
+bool Bitcask::ReserveKeyDirMemory(const std::string& key) {
+  if (options_.keydir_memory_budget == 0 || key_dir_.count(key) != 0) {
+    return true;
+  }
+
+  // A new key costs a node and copies of the key and file ID. If it tips the
+  // table over its load factor, the new bucket array is allocated before the
+  // old one is freed.
+  size_t needed = NodeBytes<KeyDirMap>() + HeapBytes(key.size()) +
+                  HeapBytes(db_path_.native().size());
+  if (key_dir_.size() + 1 >
+      key_dir_.max_load_factor() * key_dir_.bucket_count()) {
+    needed += 2 * key_dir_.bucket_count() * sizeof(void*);
+  }
+  if (options_.ordered_index) {
+    needed += TreeNodeBytes<OrderedKeys>();
+  }
+  auto fits = [&] {
+    return KeyDirMemory() + needed <= options_.keydir_memory_budget;
+  };
+  if (fits()) {
+    return true;
+  }
+
+  if (options_.keydir_full_policy == KeyDirFullPolicy::kDropExpired) {
+    // Expired keys are ignored by `Open` and `Merge` anyway, so they can go
+    // without writing a tombstone.
+    const int64_t now = NowToMicros();
+    for (auto itr = key_dir_.begin(); itr != key_dir_.end();) {
+      if (itr->second.IsExpired(now)) {
+        UntrackEntry(*itr);
+        UnindexKey(*itr);
+        itr = key_dir_.erase(itr);
+      } else {
+        ++itr;
+      }
+    }
+    if (fits()) {
+      return true;
+    }
+  }
+  return options_.keydir_full_policy == KeyDirFullPolicy::kSpill &&
+         SpillForSpace(needed);
+}
+
+bool Bitcask::SpillForSpace(size_t needed) {
+  ScopedSpan span(tracer(), "SpillForSpace");
+  const size_t budget = options_.keydir_memory_budget;
+  // Nodes are freed as they are spilled, but the bucket array never shrinks,
+  // so there may be no way to make room.
+  const size_t target = budget - budget / 16;
+  EvictColdEntries(
+      key_dir_, SpillIndexIn(spill_, db_path_.parent_path()), &clock_hand_,
+      [&] { return KeyDirMemory() + needed <= target; },
+      [&](const KeyDirMap::value_type& element) {
+        // The entry is still live, just no longer in memory.
+        UntrackEntry(element);
+        file_usage_[element.second.file_id].live_bytes +=
+            RecordSize(element.first.size(), element.second.value_sz);
+      });
+  return KeyDirMemory() + needed <= budget;
+}
+
+std::istream& Bitcask::SpillReader::Stream(const SpillIndex& spill,
+                                           uint32_t file_index) {
+  auto [itr, inserted] = streams_.try_emplace(file_index);
+  if (inserted) {
+    itr->second.open(spill.file_id(file_index), std::ios::binary);
+  }
+  return itr->second;
+}
+
+SpillIndex& Bitcask::SpillIndexIn(std::unique_ptr<SpillIndex>& spill,
+                                  const fs::path& directory) {
+  if (spill == nullptr) {
+    std::string name = std::to_string(NowToMicros());
+    spill = std::make_unique<SpillIndex>(directory /
+                                         name.append(kSpillSuffix));
+  }
+  return *spill;
+}
+
+std::string Bitcask::ReadSpilledKey(std::istream& input,
+                                    const SpillIndex::Slot& slot) {
+  // The key immediately precedes the value.
+  input.clear();
+  input.seekg(slot.value_pos - slot.key_sz);
+  std::string key;
+  ReadToTarget(input, &key, slot.key_sz);
+  return key;
+}
+
+SpillIndex::Slot* Bitcask::FindSpilled(SpillIndex& spill,
+                                       const std::string& key,
+                                       SpillReader& reader) {
+  return spill.Find(SpillIndex::Hash(key), [&](const SpillIndex::Slot& slot) {
+    return slot.key_sz == key.size() &&
+           ReadSpilledKey(reader.Stream(spill, slot.file_index), slot) == key;
+  });
+}
+
+Bitcask::KeyDirEntry Bitcask::FromSlot(const SpillIndex& spill,
+                                       const SpillIndex::Slot& slot) {
+  return {
+      .file_id = spill.file_id(slot.file_index),
+      .value_sz = slot.value_sz,
+      .codec = slot.codec,
+      .value_pos = std::streamoff(slot.value_pos),
+      .timestamp = slot.timestamp,
+      .expiry = slot.expiry,
+  };
+}
+
+void Bitcask::ToSlot(SpillIndex& spill, const KeyDirEntry& entry,
+                     size_t key_sz, SpillIndex::Slot* slot) {
+  slot->value_pos = std::streamoff(entry.value_pos);
+  slot->value_sz = entry.value_sz;
+  slot->timestamp = entry.timestamp;
+  slot->expiry = entry.expiry;
+  slot->key_sz = key_sz;
+  slot->file_index = spill.FileIndex(entry.file_id);
+  slot->codec = entry.codec;
+}
+
+template <typename Done, typename OnEvict>
+void Bitcask::EvictColdEntries(KeyDirMap& key_dir, SpillIndex& spill,
+                               size_t* clock_hand, Done done,
+                               OnEvict on_evict) {
+  std::vector<std::string> victims;
+  // Two full turns of the hand clear every referenced bit on the first, so
+  // nothing is left to evict only if the KeyDir is empty.
+  size_t buckets_left = 2 * key_dir.bucket_count();
+  while (!done() && !key_dir.empty() && buckets_left-- > 0) {
+    size_t bucket = *clock_hand % key_dir.bucket_count();
+    *clock_hand = bucket + 1;
+
+    victims.clear();
+    for (auto itr = key_dir.begin(bucket); itr != key_dir.end(bucket); ++itr) {
+      if (itr->second.referenced) {
+        itr->second.referenced = false;
+      } else {
+        victims.push_back(itr->first);
+      }
+    }
+    for (const std::string& key : victims) {
+      auto itr = key_dir.find(key);
+      SpillIndex::Slot* slot = spill.Insert(SpillIndex::Hash(key));
+      ToSlot(spill, itr->second, key.size(), slot);
+      on_evict(*itr);
+      key_dir.erase(itr);
+    }
+  }
+}
+
+std::string Bitcask::GetSpilled(const std::string& key) const {
+  ScopedSpan span(tracer(), "Get.ReadSpilled");
+  SpillReader reader;
+  std::string stored;
+  SpillIndex::Slot* slot =
+      spill_->Find(SpillIndex::Hash(key), [&](const SpillIndex::Slot& slot) {
+        if (slot.key_sz != key.size()) {
+          return false;
+        }
+        std::istream& input = reader.Stream(*spill_, slot.file_index);
+        if (ReadSpilledKey(input, slot) != key) {
+          return false;
+        }
+        // Carry on reading straight into the value.
+        ReadToTarget(input, &stored, slot.value_sz);
+        return true;
+      });
+  if (slot == nullptr || (slot->expiry != 0 && slot->expiry <= NowToMicros())) {
+    counters_.get_misses.fetch_add(1, std::memory_order_relaxed);
+    throw MissingKeyException(key);
+  }
+  counters_.get_hits.fetch_add(1, std::memory_order_relaxed);
+  counters_.bytes_read.fetch_add(slot->value_sz, std::memory_order_relaxed);
+  KeyDirEntry entry = FromSlot(*spill_, *slot);
+  std::string value = DecodeValue(entry, std::move(stored));
+  // 💡: a spilling Bitcask's Gets hold the lock exclusively (see `Get`), so
+  // this one can change the KeyDir like a Put would.
+  const_cast<Bitcask*>(this)->PromoteSpilled(key, std::move(entry));
+  return value;
+}
+
+void Bitcask::PromoteSpilled(const std::string& key, KeyDirEntry entry) {
+  ScopedSpan span(tracer(), "Get.Promote");
+  if (!ReserveKeyDirMemory(key)) {
+    return;
+  }
+  auto [itr, inserted] = key_dir_.try_emplace(key, std::move(entry));
+  // Just read, so it survives the sweep's next pass.
+  itr->second.referenced = true;
+  IndexKey(*itr);
+  TrackEntry(*itr);
+  EraseSpilled(key);
+}
+
+void Bitcask::EraseSpilled(const std::string& key) {
+  SpillReader reader;
+  SpillIndex::Slot* slot = FindSpilled(*spill_, key, reader);
+  if (slot == nullptr) {
+    return;
+  }
+  EraseSpilledSlot(slot);
+  for (auto itr = listings_.begin(); itr != listings_.end();) {
+    if (auto moved_keys = itr->lock()) {
+      moved_keys->push_back(key);
+      ++itr;
+    } else {
+      itr = listings_.erase(itr);
+    }
+  }
+}
+
+void Bitcask::EraseSpilledSlot(SpillIndex::Slot* slot) {
+  UntrackSpilled(*slot);
+  spill_->Erase(slot);
+}
+
+void Bitcask::TrackSpilled(const SpillIndex::Slot& slot) {
+  file_usage_[spill_->file_id(slot.file_index)].live_bytes +=
+      RecordSize(slot.key_sz, slot.value_sz);
+}
+
+void Bitcask::UntrackSpilled(const SpillIndex::Slot& slot) {
+  file_usage_[spill_->file_id(slot.file_index)].live_bytes -=
+      RecordSize(slot.key_sz, slot.value_sz);
+}
+
+void Bitcask::IndexKey(const KeyDirMap::value_type& element) {
+  if (options_.ordered_index) {
+    ordered_keys_.insert(&element);
+  }
+}
+
+void Bitcask::UnindexKey(const KeyDirMap::value_type& element) {
+  if (options_.ordered_index) {
+    ordered_keys_.erase(&element);
+  }
+}
+
+void Bitcask::TrackEntry(const KeyDirMap::value_type& element) {
+  const auto& [key, entry] = element;
+  file_usage_[entry.file_id].live_bytes +=
+      RecordSize(key.size(), entry.value_sz);
+  key_dir_string_bytes_ += HeapBytes(key) + HeapBytes(entry.file_id);
+}
+
+void Bitcask::UntrackEntry(const KeyDirMap::value_type& element) {
+  const auto& [key, entry] = element;
+  file_usage_[entry.file_id].live_bytes -=
+      RecordSize(key.size(), entry.value_sz);
+  key_dir_string_bytes_ -= HeapBytes(key) + HeapBytes(entry.file_id);
+}
+
+void Bitcask::Merge() {
+  ScopedSpan span(tracer(), "Merge");
+  auto lock = WriteLock();
+  // Files retired by earlier merges are still on disk, but no longer tracked.
+  std::vector<fs::path> sealed_files;
+  for (const auto& [file_id, usage] : file_usage_) {
+    if (file_id != db_path_.native()) {
+      sealed_files.push_back(file_id);
+    }
+  }
+  if (sealed_files.empty()) {
+    return;
+  }
+
+  // Visit the live entries in on-disk order so the old files are read
+  // sequentially. Expired entries are dropped from the KeyDir wherever they
+  // live, as `Open` would ignore them anyway. Spilled entries are rewritten
+  // too; their slots don't move until the expired ones are erased at the very
+  // end.
+  const int64_t now = NowToMicros();
+  std::vector<LiveEntry> live = LiveEntriesInFileOrder(now, db_path_);
+  std::vector<KeyDirMap::iterator> expired;
+  for (auto itr = key_dir_.begin(); itr != key_dir_.end(); ++itr) {
+    if (itr->second.IsExpired(now)) {
+      expired.push_back(itr);
+    }
+  }
+  SequentialReader reader(&latencies_.file_open);
+  std::string key;
+  std::string value;
+
+  std::unique_ptr<LzDictCodec> dictionary;
+  if (options_.train_dictionary) {
+    std::vector<std::string> samples;
+    size_t stride = std::max<size_t>(1, live.size() / kMaxDictionarySamples);
+    for (size_t i = 0; i < live.size(); i += stride) {
+      ReadLiveEntry(live[i], reader, &key, &value);
+      if (value.size() < options_.dictionary_max_value_size) {
+        samples.push_back(std::move(value));
+      }
+    }
+    std::vector<std::string_view> sample_views(samples.begin(), samples.end());
+    std::string trained =
+        TrainDictionary(sample_views, options_.dictionary_size);
+    if (!trained.empty()) {
+      dictionary = std::make_unique<LzDictCodec>(std::move(trained));
+    }
+  }
+
+  std::string merged_name = std::to_string(NowToMicros());
+  fs::path merging_path =
+      db_path_.parent_path() / (merged_name + std::string(kMergingSuffix));
+  fs::path merged_path =
+      db_path_.parent_path() / merged_name.append(kCaskSuffix);
+  std::ofstream output(merging_path, std::ios::binary | std::ios::trunc);
+
+  if (dictionary != nullptr) {
+    CaskEntry dictionary_entry;
+    dictionary_entry.timestamp = NowToMicros();
+    dictionary_entry.flags = kDictionaryFlag;
+    dictionary_entry.value = dictionary->dictionary();
+    dictionary_entry.value_sz = dictionary_entry.value.size();
+    output << dictionary_entry;
+  }
+
+  // The KeyDir is only updated once the merged file is complete.
+  std::vector<KeyDirEntry> merged_entries;
+  merged_entries.reserve(live.size());
+  for (const LiveEntry& entry : live) {
+    ReadLiveEntry(entry, reader, &key, &value);
+
+    CaskEntry cask_entry;
+    cask_entry.timestamp = entry.timestamp;
+    cask_entry.expiry = entry.expiry;
+    cask_entry.key_sz = key.size();
+    cask_entry.key = key;
+
+    std::string compressed;
+    if (dictionary != nullptr &&
+        value.size() < options_.dictionary_max_value_size) {
+      dictionary->Compress(value, &compressed);
+    }
+    if (!compressed.empty() && compressed.size() < value.size()) {
+      cask_entry.value = std::move(compressed);
+      cask_entry.value_sz = cask_entry.value.size();
+      cask_entry.codec = CodecId::kLzDict;
+    } else {
+      EncodeValue(std::move(value), cask_entry);
+    }
+
+    merged_entries.push_back({
+        .file_id = merged_path,
+        .value_sz = cask_entry.value_sz,
+        .codec = cask_entry.codec,
+        .value_pos = output.tellp() + cask_entry.ValueOffset(),
+        .timestamp = entry.timestamp,
+        .expiry = entry.expiry,
+    });
+    output << cask_entry;
+  }
+  uint64_t merged_size = output.tellp();
+  output.close();
+  reader.Close();
+
+  fs::rename(merging_path, merged_path);
+  file_usage_[merged_path].total_bytes = merged_size;
+  counters_.bytes_written.fetch_add(merged_size, std::memory_order_relaxed);
+  for (size_t i = 0; i < live.size(); ++i) {
+    if (live[i].itr == key_dir_.end()) {
+      SpillIndex::Slot& slot = spill_->slot(live[i].slot);
+      UntrackSpilled(slot);
+      ToSlot(*spill_, merged_entries[i], slot.key_sz, &slot);
+      TrackSpilled(slot);
+      continue;
+    }
+    // 💡: erasing an empty range is how to get a mutable iterator back from a
+    // const one.
+    auto itr = key_dir_.erase(live[i].itr, live[i].itr);
+    UntrackEntry(*itr);
+    itr->second = std::move(merged_entries[i]);
+    TrackEntry(*itr);
+  }
+  for (const auto& itr : expired) {
+    UntrackEntry(*itr);
+    UnindexKey(*itr);
+    key_dir_.erase(itr);
+  }
+  if (spill_ != nullptr) {
+    spill_->EraseIf([&](const SpillIndex::Slot& slot) {
+      bool is_expired = slot.expiry != 0 && slot.expiry <= now;
+      if (is_expired) {
+        UntrackSpilled(slot);
+      }
+      return is_expired;
+    });
+  }
+  for (const auto& path : sealed_files) {
+    dictionaries_.erase(path);
+    file_usage_.erase(path);
+  }
+  auto retired = std::make_shared<RetiredFiles>();
+  retired->paths = std::move(sealed_files);
+  for (auto itr = snapshots_.begin(); itr != snapshots_.end();) {
+    if (auto snapshot = itr->lock()) {
+      snapshot->retired.push_back(retired);
+      ++itr;
+    } else {
+      itr = snapshots_.erase(itr);
+    }
+  }
+  // Deletes the files right away unless a snapshot took a reference.
+  retired.reset();
+  if (dictionary != nullptr) {
+    dictionaries_[merged_path] = std::move(dictionary);
+  }
+}
+
 }  // namespace rd::bitcask
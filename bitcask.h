@@ -5,12 +5,36 @@
 // Nothing here should ever be used for anything - this is just tinkering
 // around with implementing Bitcask in C++.
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "compression.h"
+#include "counting_allocator.h"
+#include "file_writer.h"
+#include "histogram.h"
+#include "io_executor.h"
+#include "mpsc_ring.h"
+#include "spill_index.h"
+#include "trace.h"
+#include "value_cache.h"
+
 namespace rd::bitcask {
 
 // Exception thrown when trying to access a key that doesn't exist.
@@ -30,6 +54,172 @@ struct MissingKeyException : public std::exception {
   std::string message_;
 };
 
+// Exception thrown when the KeyDir would outgrow `Options::keydir_memory_budget`.
+struct KeyDirFullException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// What a `Bitcask` does when a new key would take the KeyDir over budget.
+enum class KeyDirFullPolicy {
+  // Throw `KeyDirFullException`, leaving the Bitcask unchanged.
+  kReject,
+  // Drop expired keys from the KeyDir, then reject if that wasn't enough.
+  kDropExpired,
+  // Move cold keys (those not read since the last sweep, CLOCK-style) to an
+  // on-disk index (see spill_index.h) in the cask directory. Lookups of
+  // spilled keys cost a probe of that index, but no extra read of the cask
+  // files, and bring the key back into memory (as do Puts). The budget then
+  // only bounds the in-memory part of the KeyDir, so the Bitcask can hold
+  // more keys than fit in memory.
+  kSpill,
+};
+
+// Options controlling the behavior of a `Bitcask`.
+struct Options {
+  // Codec used to compress values written by `Put`. Values are only stored
+  // compressed when that actually makes them smaller.
+  CodecId compression = CodecId::kNone;
+
+  // Values shorter than this are always stored raw - the codec's framing
+  // overhead tends to outweigh any savings.
+  size_t compression_min_size = 64;
+
+  // When set, `Merge` trains a compression dictionary from a sample of the
+  // values it rewrites and stores it in the merged file. Values shorter than
+  // `dictionary_max_value_size` are then compressed against it - similar small
+  // values share far more with each other than with themselves.
+  bool train_dictionary = false;
+  size_t dictionary_size = 16 * 1024;
+  size_t dictionary_max_value_size = 1024;
+
+  // Receives a span for each phase of `Open`, `Put`, `Get`, `Delete` and
+  // `Merge` (see trace.h), e.g. a `ChromeTraceWriter`. Tracing is off when
+  // unset.
+  std::shared_ptr<TraceSink> trace_sink = nullptr;
+
+  // Upper bound on `BitcaskStats::keydir_memory_bytes`, or 0 for none. A `Put`
+  // of a new key that would exceed it applies `keydir_full_policy` before
+  // anything is written, and `Open` throws `KeyDirFullException` if the
+  // existing files don't fit.
+  size_t keydir_memory_budget = 0;
+  KeyDirFullPolicy keydir_full_policy = KeyDirFullPolicy::kReject;
+
+  // Keeps the KeyDir's keys in order too, enabling `Scan` and `PrefixScan`.
+  // The index points at the KeyDir's own keys rather than copying them, and
+  // counts towards `keydir_memory_budget`. Can't be combined with
+  // `KeyDirFullPolicy::kSpill`, as spilled keys aren't in memory.
+  bool ordered_index = false;
+
+  // Makes the Bitcask safe to use from many threads at once. Puts and Deletes
+  // are queued (lock-free) for a dedicated writer thread, which appends them
+  // in batches and flushes the active file once per batch rather than once
+  // per write; each call still returns only once its write is flushed.
+  // Reads run concurrently with each other and wait out each batch. If a
+  // flush fails, that batch's writes and every later one throw its error.
+  bool writer_thread = false;
+
+  // CPU the writer thread is pinned to, or -1 to leave it to the scheduler.
+  // Pinning is best-effort (and Linux-only).
+  int writer_cpu = -1;
+
+  // Threads running the blocking part of `GetAsync`, `PutAsync` and
+  // `DeleteAsync` (started on first use). Without `writer_thread` the Bitcask
+  // isn't thread-safe, so there's only ever one.
+  size_t io_threads = 4;
+
+  // Space reserved for the active file at a time, or 0 to let it grow block
+  // by block. Appending into reserved space keeps the file in a few large
+  // extents and spares each flush from allocating blocks. Whatever is left
+  // unused is given back when the file is sealed. Linux-only.
+  size_t preallocate_bytes = 8 * 1024 * 1024;
+
+  // Writes the active file with direct I/O (see direct_file.h), keeping
+  // write-once data out of the page cache so it holds the values `Get`
+  // reads instead. Linux-only.
+  bool direct_io = false;
+
+  // Bytes of decoded values `Get` keeps in memory (see value_cache.h), or 0
+  // for no cache. Hits skip the file read and decoding altogether.
+  size_t value_cache_bytes = 0;
+};
+
+// Point-in-time copy of a `Bitcask`'s statistics (see `Bitcask::Stats`).
+struct BitcaskStats {
+  // Latencies (in nanoseconds) of each public operation, end to end.
+  Histogram put_latency;
+  Histogram get_latency;
+  Histogram delete_latency;
+  // Latencies of flushing the active file, which every Put/Delete does.
+  Histogram flush_latency;
+  // Latencies of opening cask files, whether to load, read or write them.
+  Histogram file_open_latency;
+
+  // Counters (the number of calls to each operation is the count of its
+  // histogram above).
+  uint64_t get_hits = 0;
+  uint64_t get_misses = 0;
+  // Bytes appended to / read from cask files, including headers and keys
+  // (and everything `Merge` rewrites).
+  uint64_t bytes_written = 0;
+  uint64_t bytes_read = 0;
+  // Gets answered by the value cache (`Options::value_cache_bytes`).
+  uint64_t value_cache_hits = 0;
+
+  // Gauges.
+  // Keys in the KeyDir, of which `keydir_spilled_entries` are on disk (see
+  // `KeyDirFullPolicy::kSpill`).
+  uint64_t keydir_entries = 0;
+  uint64_t keydir_spilled_entries = 0;
+  // Heap bytes requested by the KeyDir: its nodes and buckets (and those of
+  // its ordered index, if any) as counted by its allocator, plus keys and
+  // file IDs too long for a string's inline buffer. Per-allocation malloc
+  // overhead comes on top.
+  uint64_t keydir_memory_bytes = 0;
+  uint64_t cask_files = 0;
+  // Bytes on disk still referenced by the KeyDir, and bytes a merge would
+  // reclaim (overwritten values, tombstones, dictionaries).
+  uint64_t live_bytes = 0;
+  uint64_t dead_bytes = 0;
+  uint64_t active_file_bytes = 0;
+  // Bytes held by the value cache.
+  uint64_t value_cache_bytes = 0;
+
+  // Adds `other`'s histograms, counters and gauges to these, e.g. to total
+  // the stats of several Bitcasks.
+  void Merge(const BitcaskStats& other);
+
+  // Human-readable, one line per histogram/value.
+  std::string ToString() const;
+
+  // Everything above in the Prometheus text exposition format, with metrics
+  // prefixed `bitcask_`. Latencies become summaries in seconds.
+  std::string ToPrometheusText() const;
+};
+
+// Position of a key listing that resumes across calls to
+// `Bitcask::NextKeys`. A default-constructed cursor starts at the beginning.
+class KeyCursor {
+ public:
+  // Whether every key has been returned.
+  bool done() const { return phase_ == Phase::kDone; }
+
+ private:
+  friend class Bitcask;
+
+  enum class Phase { kKeyDir, kSpilled, kDone };
+  Phase phase_ = Phase::kKeyDir;
+  // Next KeyDir bucket, or (bit-reversed) home slot of the spill index.
+  size_t position_ = 0;
+  // KeyDir bucket count when `position_` was handed out.
+  size_t bucket_count_ = 0;
+  // Keys moved from the spill index back into memory since the last call,
+  // which the listing might otherwise miss. Shared with the Bitcask, which
+  // fills it in; null unless the Bitcask spills.
+  std::shared_ptr<std::vector<std::string>> moved_keys_;
+};
+
+class BitcaskSnapshot;
+
 // `Bitcask` manages all operations on the underlying data.
 class Bitcask {
  public:
@@ -37,25 +227,123 @@ class Bitcask {
 
   // Opens a new/existing Bitcask rooted at `directory_name`.
   //
-  // TODO: Support options (e.g., opening read/write casks).
+  // TODO: Support more options (e.g., opening read/write casks).
+  //
+  // Throws `std::invalid_argument` if `options` are inconsistent.
   //
   // Note that calling this creates a new (empty) file. Existing Bitcask files
   // in `directory_name` (e.g., from an old process that was shut down) are
   // loaded into the Bitcask before it is returned.
-  static Bitcask Open(const std::string& directory_name);
+  static Bitcask Open(const std::string& directory_name,
+                      const Options& options = {});
 
   // Stores `key` with `value` in the Bitcask.
+  //
+  // Throws `KeyDirFullException` if `key` is new and there's no room for it
+  // in `Options::keydir_memory_budget`.
   void Put(const std::string& key, std::string value);
 
+  // Stores `key` with `value`, expiring it once `ttl` has elapsed. Expired
+  // keys behave as if deleted, and are dropped for good by `Open` and `Merge`
+  // without ever writing a tombstone.
+  void Put(const std::string& key, std::string value,
+           std::chrono::microseconds ttl);
+
   // Retrieves the value associated with `key`.
   std::string Get(const std::string& key) const;
 
   // Deletes the value associated with `key`.
   void Delete(const std::string& key);
 
+#ifdef RD_BITCASK_HAS_COROUTINES
+  // `co_await`-able versions of `Get`, `Put` and `Delete` (see
+  // io_executor.h), for C++20 builds. The call itself runs on an internal
+  // I/O thread (see `Options::io_threads`), where the awaiting coroutine is
+  // resumed once it returns.
+  //
+  // Unless there's a writer thread, these mustn't overlap with synchronous
+  // calls made from other threads.
+  AsyncResult<std::string> GetAsync(std::string key) const;
+  AsyncResult<void> PutAsync(
+      std::string key, std::string value,
+      std::chrono::microseconds ttl = std::chrono::microseconds::zero());
+  AsyncResult<void> DeleteAsync(std::string key);
+#endif  // RD_BITCASK_HAS_COROUTINES
+
   // List all of the keys in this Bitcask.
+  //
+  // This copies every key at once; prefer `NextKeys` for large Bitcasks.
   std::vector<std::string> ListKeys() const;
 
+  // Returns the next keys of the listing at `cursor`, and advances it. Keys
+  // come a KeyDir bucket at a time, so a chunk may be slightly larger than
+  // `max_keys`.
+  //
+  // Puts and Deletes may happen between calls: every key present for the whole
+  // listing is returned, and keys added or removed meanwhile may or may not
+  // be. A key is only returned twice if, in between, the KeyDir's table grew
+  // (which restarts the in-memory part of the listing) or the key moved
+  // between memory and disk (see `KeyDirFullPolicy::kSpill`).
+  std::vector<std::string> NextKeys(KeyCursor& cursor, size_t max_keys) const;
+
+  // Calls `fn(key, value)` for every live key. Values are visited in the order
+  // they're laid out on disk rather than KeyDir order, so each file is read
+  // sequentially and opened once.
+  //
+  // `fn` must not modify this Bitcask.
+  void Fold(const std::function<void(const std::string& key,
+                                     const std::string& value)>& fn) const;
+
+  // Lists the keys in [`start`, `end`) / starting with `prefix`, in order.
+  // `Scan` stops after the first `max_keys`. Only the KeyDir is consulted;
+  // values are read by `Get` as they're needed.
+  //
+  // Require `Options::ordered_index` (and throw `std::logic_error` without).
+  std::vector<std::string> Scan(std::string_view start, std::string_view end,
+                                size_t max_keys = SIZE_MAX) const;
+  std::vector<std::string> PrefixScan(std::string_view prefix) const;
+
+  // Rewrites every sealed cask file (i.e., all but the one currently being
+  // written) into a single new file holding only live entries, then deletes
+  // the originals. Overwritten values and tombstones are dropped.
+  //
+  // Files that snapshots may still read are only deleted once the last of
+  // those snapshots is destroyed.
+  void Merge();
+
+  // Returns a read-only view of the live keys and values as of now, which
+  // later Puts, Deletes and Merges don't affect.
+  //
+  // Cask files are append-only, so this copies just the KeyDir, not the
+  // values. Of spilled keys, only the spill index's fixed-size slots are
+  // copied; the keys are read from disk when the snapshot needs them. With
+  // nothing written since the last snapshot, the new one shares its copy.
+  BitcaskSnapshot Snapshot() const;
+
+  // Makes a copy of this Bitcask in `directory_name` (which mustn't exist yet)
+  // that `Open` can load, e.g. for a backup.
+  //
+  // The active file is sealed (later writes go to a new one), then every cask
+  // file is hard-linked into `directory_name`: cask files never change once
+  // sealed, so this takes the same time however much data there is. Files
+  // are only copied if `directory_name` is on another filesystem. A
+  // `MANIFEST` listing the files is written last, so a checkpoint without one
+  // is incomplete. Everything is synced to disk before this returns.
+  void Checkpoint(const std::string& directory_name);
+
+  // Returns the statistics collected since this Bitcask was opened, along with
+  // the current value of each gauge.
+  //
+  // Collection is always on and cheap: each thread records into its own
+  // histograms, which are only merged here, and gauges are kept up to date
+  // as the KeyDir changes rather than computed by walking it.
+  BitcaskStats Stats() const;
+
+  // Bitcasks can't be moved (`Open` returns one in place), as the writer
+  // thread refers back to its Bitcask.
+  Bitcask(const Bitcask&) = delete;
+  Bitcask& operator=(const Bitcask&) = delete;
+
  private:
   // Value piece of the KeyDir hash table.
   //
@@ -65,33 +353,81 @@ class Bitcask {
     // Unique ID of the file containing this entry (in this implementation,
     // just a file path).
     std::string file_id;
-    // Size of the value referenced by this key.
+    // Size of the value referenced by this key (as stored on disk).
     size_t value_sz;
+    // Codec the stored value was encoded with.
+    CodecId codec;
     // Offset of the value within `file_id`.
     std::streampos value_pos;
     // Timestamp of when this entry was created. This allows pruning/expiring
     // older entries when loading existing Bitcask files.
     int64_t timestamp;
+    // Timestamp after which this entry is considered deleted (0 if never).
+    int64_t expiry;
+    // Whether `Get` has read this entry since the eviction sweep last passed
+    // it (only maintained with `KeyDirFullPolicy::kSpill`).
+    mutable bool referenced = false;
+
+    bool IsExpired(int64_t now) const { return expiry != 0 && expiry <= now; }
+  };
+
+  // Bits stored in `CaskEntry::flags`.
+  enum EntryFlags : uint8_t {
+    // The entry deletes its key. Tombstones carry no value bytes.
+    kTombstoneFlag = 1 << 0,
+    // The entry holds the dictionary for values in its file encoded with
+    // `CodecId::kLzDict`. Dictionary entries never make it into the KeyDir.
+    kDictionaryFlag = 1 << 1,
   };
 
+  // Sealed files replaced by a `Merge` while snapshots were open. They're
+  // deleted together, once no snapshot refers to them: keeping all of them
+  // means a crash in the meantime still loads a consistent KeyDir (the
+  // tombstones that hide old values stay with them).
+  struct RetiredFiles {
+    std::vector<std::filesystem::path> paths;
+
+    ~RetiredFiles();
+  };
+
+  // What a `BitcaskSnapshot` reads from.
+  struct SnapshotState;
+  friend class BitcaskSnapshot;
+
   // A single entry within the Bitcask.
   struct CaskEntry {
     // TODO: CRC
     int64_t timestamp = 0;
+    int64_t expiry = 0;
     size_t key_sz = 0;
     size_t value_sz = 0;
+    uint8_t flags = 0;
+    CodecId codec = CodecId::kNone;
     std::string key;
     std::string value;
 
+    bool IsTombstone() const { return flags & kTombstoneFlag; }
+    bool IsDictionary() const { return flags & kDictionaryFlag; }
+
     // Human-readable representation of this entry.
     std::string DebugString() const {
       std::stringstream ss;
-      ss << "CaskEntry(" << timestamp << ", key_size:" << key_sz
-         << ", value_sz:" << value_sz << ", key:" << key << ", value:" << value
-         << ")\n";
+      ss << "CaskEntry(" << timestamp << ", expiry:" << expiry
+         << ", key_size:" << key_sz
+         << ", value_sz:" << value_sz << ", flags:" << int{flags}
+         << ", codec:" << static_cast<int>(codec)
+         << ", key:" << key << ", value:" << value << ")\n";
       return ss.str();
     }
 
+    // Appends this entry's header and key (everything before the value) to
+    // `output`. The one definition of the on-disk layout, which `operator<<`
+    // writes through too.
+    void SerializeHeaderAndKey(std::string* output) const;
+
+    // Size of the fixed-width fields that precede the key.
+    static std::streamoff HeaderSize();
+
     // Helper for calculating this entry's value's offset in the underlying
     // file (useful when writing the entry to the KeyDir).
     std::streamoff ValueOffset();
@@ -101,14 +437,388 @@ class Bitcask {
   friend std::istream& operator>>(std::istream& input, CaskEntry& cask_entry);
   friend std::ostream& operator<<(std::ostream& output, CaskEntry& cask_entry);
 
-  using KeyDirMap = std::unordered_map<std::string, KeyDirEntry>;
+  // Reads everything but the value of the next entry in `input`, leaving
+  // `input` positioned at the start of the next entry. Used when loading the
+  // KeyDir, which never needs the value bytes (dictionary entries aside).
+  static std::istream& ReadEntrySkippingValue(std::istream& input,
+                                              CaskEntry& cask_entry);
+
+  using KeyDirMap = std::unordered_map<
+      std::string, KeyDirEntry, std::hash<std::string>,
+      std::equal_to<std::string>,
+      CountingAllocator<std::pair<const std::string, KeyDirEntry>>>;
+  // Orders pointers to KeyDir elements by key, and compares them with plain
+  // keys for lookups.
+  struct KeyOrder {
+    using is_transparent = void;
+    static std::string_view Key(const KeyDirMap::value_type* element) {
+      return element->first;
+    }
+    static std::string_view Key(std::string_view key) { return key; }
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+      return Key(a) < Key(b);
+    }
+  };
+  // KeyDir nodes never move, so the ordered index can point into them.
+  using OrderedKeys =
+      std::set<const KeyDirMap::value_type*, KeyOrder,
+               CountingAllocator<const KeyDirMap::value_type*>>;
+  // Per-file compression dictionaries, keyed by file ID. Shared with
+  // snapshots.
+  using DictionaryMap =
+      std::unordered_map<std::string, std::shared_ptr<const LzDictCodec>>;
+
+  // Space taken by a cask file, for the live/dead byte gauges.
+  struct FileUsage {
+    uint64_t total_bytes = 0;
+    // Bytes of the entries the KeyDir points into this file.
+    uint64_t live_bytes = 0;
+  };
 
-  // Constructs a new Bitcask at `path` with a pre-populated `key_dir`.
-  explicit Bitcask(std::filesystem::path path, KeyDirMap key_dir);
+  // Everything `Open` gathers from the existing files.
+  struct LoadedCask {
+    KeyDirMap key_dir;
+    // Entries evicted from `key_dir` (only with `KeyDirFullPolicy::kSpill`).
+    std::unique_ptr<SpillIndex> spill;
+    // CLOCK hand of the eviction sweep, as a bucket of `key_dir`.
+    size_t clock_hand = 0;
+    DictionaryMap dictionaries;
+    // Sizes of the loaded files (live bytes are filled in by the
+    // constructor).
+    std::unordered_map<std::string, FileUsage> file_usage;
+    // Collected before the Bitcask (and its histograms) exist.
+    Histogram file_open_latency;
+    // Largest timestamp of any entry read, which new ones must come after.
+    int64_t last_timestamp = 0;
+  };
 
+  // Always-on latency histograms behind `Stats`.
+  struct Latencies {
+    ConcurrentHistogram put;
+    ConcurrentHistogram get;
+    ConcurrentHistogram del;
+    ConcurrentHistogram flush;
+    ConcurrentHistogram file_open;
+  };
+
+  // Counters behind `Stats` that aren't histogram counts.
+  struct Counters {
+    std::atomic<uint64_t> get_hits{0};
+    std::atomic<uint64_t> get_misses{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> value_cache_hits{0};
+  };
+
+  // Constructs a new Bitcask at `path` with a pre-populated KeyDir.
+  explicit Bitcask(std::filesystem::path path, LoadedCask loaded,
+                   Options options);
+
+  // Starts a new, empty active file, leaving the current one as is.
+  void SealActiveFile();
+
+  // Creates the active file at `db_path_` / closes it (see
+  // `FileWriter::Close`).
+  void OpenActiveFile();
+  void CloseActiveFile();
+
+  // Makes sure space is reserved for the active file up to `end` (see
+  // `Options::preallocate_bytes`).
+  void Preallocate(uint64_t end);
+
+  // Appends `cask_entry` to the active file, returning the offset of its value.
+  // The entry is only durable once `Flush` is called.
+  std::streampos Append(CaskEntry& cask_entry);
+  void Flush();
+
+  // The parts of `Put` and `Delete` that change the Bitcask, without flushing.
+  // `cask_entry` holds the encoded value; its timestamps are set here.
+  // `DeleteEntry` returns whether `key` existed (and a tombstone was written).
+  void PutEntry(CaskEntry& cask_entry, std::chrono::microseconds ttl);
+  bool DeleteEntry(const std::string& key);
+
+  // Returns the current time, or one microsecond past the last timestamp
+  // handed out (or loaded by `Open`) if the clock hasn't moved on. Two writes
+  // of a key must never share a timestamp, or `Open` can't tell which came
+  // last - and a burst of writes can run ahead of the clock, so this holds
+  // across reopens too.
+  int64_t NextTimestamp();
+
+  // A Put (or Delete, if `cask_entry` is a tombstone) waiting for the writer
+  // thread.
+  struct WriteRequest {
+    CaskEntry cask_entry;
+    std::chrono::microseconds ttl{};
+    // Set by the writer thread, which then sets `done` under
+    // `Writer::done_mu`.
+    std::exception_ptr error = nullptr;
+    bool done = false;
+  };
+
+  // The writer thread and its queue (see `Options::writer_thread`).
+  struct Writer {
+    static constexpr size_t kQueueSize = 1024;
+    static constexpr size_t kMaxBatch = 256;
+
+    MpscRing<WriteRequest*> queue{kQueueSize};
+    std::atomic<bool> stop{false};
+    // Set while the writer thread waits on `wake` for an empty queue to
+    // fill, so submitters only take `wake_mu` when there's someone to wake.
+    std::atomic<bool> sleeping{false};
+    std::mutex wake_mu;
+    std::condition_variable wake;
+    // Submitters wait on `done` for their requests.
+    std::mutex done_mu;
+    std::condition_variable done;
+    // Set (before `failed`) once a flush fails. The file may be torn from
+    // then on, so every later request fails with this instead of being
+    // written after it.
+    std::exception_ptr failure = nullptr;
+    std::atomic<bool> failed{false};
+    std::thread thread;
+  };
+
+  // Queues `request` for the writer thread and waits until it's flushed,
+  // rethrowing anything it threw. Throws `Writer::failure` straight away once
+  // there is one.
+  void Submit(WriteRequest& request);
+
+  // Body of the writer thread: applies queued requests a batch at a time
+  // until `Writer::stop`.
+  void RunWriter();
+  void ApplyBatch(const std::vector<WriteRequest*>& batch);
+
+  // Returns the executor behind the async API, starting it if need be.
+  IoExecutor& Executor() const;
+
+  // Lock `mu_` if there's a writer thread, and do nothing otherwise.
+  std::shared_lock<std::shared_mutex> ReadLock() const;
+  std::unique_lock<std::shared_mutex> WriteLock() const;
+
+  // Sets `cask_entry`'s value to `value`, compressed per `options_`.
+  void EncodeValue(std::string value, CaskEntry& cask_entry) const;
+
+  // Reads the value referenced by `entry` from `input` as stored on disk.
+  static std::string ReadStoredValue(std::istream& input,
+                                     const KeyDirEntry& entry);
+
+  // Decodes a value returned by `ReadStoredValue`.
+  std::string DecodeValue(const KeyDirEntry& entry, std::string stored) const {
+    return DecodeValue(dictionaries_, entry, std::move(stored));
+  }
+  static std::string DecodeValue(const DictionaryMap& dictionaries,
+                                 const KeyDirEntry& entry, std::string stored);
+
+  TraceSink* tracer() const { return options_.trace_sink.get(); }
+
+  // Heap bytes used by the KeyDir (see `BitcaskStats::keydir_memory_bytes`).
+  size_t KeyDirMemory() const;
+
+  // Applies `Options::keydir_full_policy` if inserting `key` would take the
+  // KeyDir over budget. Returns false if there's still no room.
+  bool ReserveKeyDirMemory(const std::string& key);
+
+  // A live (unexpired) entry of the KeyDir, wherever it's kept.
+  struct LiveEntry {
+    // Where the value is stored. Points into the KeyDir or the spill index,
+    // so only valid until either next changes.
+    const std::string* file_id;
+    std::streamoff value_pos;
+    int64_t timestamp;
+    int64_t expiry;
+    // The KeyDir element, or `key_dir_.end()` for the spill index slot at
+    // position `slot`.
+    KeyDirMap::const_iterator itr;
+    size_t slot = 0;
+  };
+
+  // Returns the live entries with values outside `skip_file_id`, sorted by
+  // file and offset so they can be read sequentially.
+  std::vector<LiveEntry> LiveEntriesInFileOrder(
+      int64_t now, const std::string& skip_file_id) const;
+
+  // Reads from one file after another, keeping the current file open while
+  // consecutive reads share it.
+  class SequentialReader {
+   public:
+    // Records how long each file takes to open in `file_open_latency`, if
+    // set.
+    explicit SequentialReader(ConcurrentHistogram* file_open_latency)
+        : file_open_latency_(file_open_latency) {}
+
+    // Returns the stream of `file_id`, positioned at `pos`.
+    std::istream& Seek(const std::string& file_id, std::streamoff pos);
+
+    void Close() {
+      input_.close();
+      file_id_.clear();
+    }
+
+   private:
+    ConcurrentHistogram* file_open_latency_;
+    std::ifstream input_;
+    std::string file_id_;
+  };
+
+  // Reads the key (copied from memory unless spilled) and decoded value of
+  // `live`.
+  void ReadLiveEntry(const LiveEntry& live, SequentialReader& reader,
+                     std::string* key, std::string* value) const;
+
+  // Streams for reading spilled keys back from the cask files, opened on
+  // first use.
+  class SpillReader {
+   public:
+    std::istream& Stream(const SpillIndex& spill, uint32_t file_index);
+
+   private:
+    std::unordered_map<uint32_t, std::ifstream> streams_;
+  };
+
+  // Returns `spill`, creating it in `directory` if it doesn't exist yet.
+  static SpillIndex& SpillIndexIn(std::unique_ptr<SpillIndex>& spill,
+                                  const std::filesystem::path& directory);
+
+  // Reads the key of `slot` from `input`, leaving `input` at its value.
+  static std::string ReadSpilledKey(std::istream& input,
+                                    const SpillIndex::Slot& slot);
+
+  // Returns the slot holding `key`, or nullptr.
+  static SpillIndex::Slot* FindSpilled(SpillIndex& spill,
+                                       const std::string& key,
+                                       SpillReader& reader);
+
+  // Converts between KeyDir entries and spilled slots.
+  static KeyDirEntry FromSlot(const SpillIndex& spill,
+                              const SpillIndex::Slot& slot);
+  static void ToSlot(SpillIndex& spill, const KeyDirEntry& entry,
+                     size_t key_sz, SpillIndex::Slot* slot);
+
+  // Moves entries from `key_dir` to `spill` in CLOCK order - passing over
+  // (and clearing) those referenced since the hand last came by - until
+  // `done()`. `on_evict` sees each entry just before it is erased.
+  template <typename Done, typename OnEvict>
+  static void EvictColdEntries(KeyDirMap& key_dir, SpillIndex& spill,
+                               size_t* clock_hand, Done done,
+                               OnEvict on_evict);
+
+  // Spills cold entries until the KeyDir has `needed` bytes to spare (and
+  // then some, so the next few Puts don't have to). Returns false if it
+  // couldn't.
+  bool SpillForSpace(size_t needed);
+
+  // Reads a spilled key's value, or throws `MissingKeyException`. The key
+  // then moves back into memory, as it's evidently not cold.
+  std::string GetSpilled(const std::string& key) const;
+
+  // Moves a spilled key back into the KeyDir with `entry` (its current
+  // location), spilling colder entries to make room. Leaves it spilled if
+  // there's still no room.
+  void PromoteSpilled(const std::string& key, KeyDirEntry entry);
+
+  // Removes `key`'s spilled entry, if it has one, as it moves back into the
+  // KeyDir. Listings in progress are told (see `listings_`).
+  void EraseSpilled(const std::string& key);
+
+  // Removes a spilled entry.
+  void EraseSpilledSlot(SpillIndex::Slot* slot);
+
+  // Adds/removes a spilled entry's bytes to/from the live byte gauges (the
+  // KeyDir memory gauges don't cover the spill index).
+  void TrackSpilled(const SpillIndex::Slot& slot);
+  void UntrackSpilled(const SpillIndex::Slot& slot);
+
+  // Bytes on disk of an entry with the given key and value sizes.
+  static uint64_t RecordSize(size_t key_sz, size_t value_sz) {
+    return CaskEntry::HeaderSize() + key_sz + value_sz;
+  }
+
+  // Adds/removes a KeyDir element to/from the ordered index (if enabled).
+  // Removal must come before the element is erased from `key_dir_`.
+  void IndexKey(const KeyDirMap::value_type& element);
+  void UnindexKey(const KeyDirMap::value_type& element);
+
+  // Throws `std::logic_error` unless `Options::ordered_index` is set.
+  void CheckOrderedIndex() const;
+
+  // Adds/removes a KeyDir element to/from the gauges. Every insertion into
+  // `key_dir_` is followed by `TrackEntry` and every modification or removal
+  // is preceded by `UntrackEntry`.
+  void TrackEntry(const KeyDirMap::value_type& element);
+  void UntrackEntry(const KeyDirMap::value_type& element);
+
+  Options options_;
   std::filesystem::path db_path_;
-  std::unique_ptr<std::ofstream> f_;
+  std::unique_ptr<FileWriter> f_;
+  // Whether to keep reserving space for the active file (see
+  // `Options::preallocate_bytes`), and how much it has so far.
+  bool preallocate_ = false;
+  uint64_t preallocated_bytes_ = 0;
+  // Reused by `Append` to assemble each record's header and key.
+  std::string record_;
   KeyDirMap key_dir_;
+  // Shares `key_dir_`'s allocation counter. Empty unless
+  // `Options::ordered_index`.
+  OrderedKeys ordered_keys_;
+  DictionaryMap dictionaries_;
+  mutable Latencies latencies_;
+  mutable Counters counters_;
+  std::unordered_map<std::string, FileUsage> file_usage_;
+  // Snapshots handed out, which `Merge` hands the files it replaces to.
+  mutable std::vector<std::weak_ptr<SnapshotState>> snapshots_;
+  mutable std::mutex snapshots_mu_;
+  // Puts and Deletes applied so far, which tells `Snapshot` whether the
+  // latest snapshot is still current.
+  uint64_t writes_ = 0;
+  // Key listings in progress (see `KeyCursor::moved_keys_`), which
+  // `EraseSpilled` tells about keys moving back into memory. Only used when
+  // spilling.
+  mutable std::vector<std::weak_ptr<std::vector<std::string>>> listings_;
+  // Cold part of the KeyDir; null until something is spilled.
+  std::unique_ptr<SpillIndex> spill_;
+  size_t clock_hand_ = 0;
+  // Null unless `Options::value_cache_bytes`.
+  std::unique_ptr<ValueCache> value_cache_;
+  // Heap bytes owned by the KeyDir's strings (nodes and buckets are counted
+  // by its allocator).
+  size_t key_dir_string_bytes_ = 0;
+  int64_t last_timestamp_ = 0;
+  // Null unless `Options::writer_thread`. The writer thread holds `mu_`
+  // exclusively while it applies a batch; public methods other than Put and
+  // Delete hold it too (shared where they only read).
+  std::unique_ptr<Writer> writer_;
+  mutable std::shared_mutex mu_;
+  // Null until the async API is first used.
+  mutable std::once_flag executor_started_;
+  mutable std::unique_ptr<IoExecutor> executor_;
+};
+
+// Read-only, point-in-time view of a `Bitcask` (see `Bitcask::Snapshot`).
+//
+// Cheap to copy, and safe to read from any thread - including while the
+// Bitcask it came from is written to, merged, or destroyed.
+class BitcaskSnapshot {
+ public:
+  // Retrieves the value associated with `key` when the snapshot was taken,
+  // or throws `MissingKeyException`.
+  std::string Get(const std::string& key) const;
+
+  // Lists the keys in the snapshot.
+  std::vector<std::string> ListKeys() const;
+
+  // Calls `fn(key, value)` for every key in the snapshot, reading each file
+  // sequentially (see `Bitcask::Fold`).
+  void Fold(const std::function<void(const std::string& key,
+                                     const std::string& value)>& fn) const;
+
+ private:
+  friend class Bitcask;
+
+  explicit BitcaskSnapshot(std::shared_ptr<const Bitcask::SnapshotState> state)
+      : state_(std::move(state)) {}
+
+  std::shared_ptr<const Bitcask::SnapshotState> state_;
 };
 
 }  // namespace rd::bitcask
@@ -0,0 +1,286 @@
+// Benchmarks for the core Bitcask operations.
+//
+// Command:
+//   $ ./build/bitcask_bench --benchmark_filter=Get
+//
+// Every benchmark reports items/s (operations) and, where it makes sense,
+// bytes/s (key + value bytes moved). Arguments are named in the output, e.g.
+// `BM_Put/key:16/value:1024`.
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bitcask.h"
+#include "workload.h"
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+// A fresh directory that is removed when the benchmark is done with it.
+class ScratchDir {
+ public:
+  ScratchDir() {
+    static int counter = 0;
+    path_ = fs::temp_directory_path() /
+            ("bitcask_bench_" + std::to_string(getpid()) + "_" +
+             std::to_string(counter++));
+    fs::remove_all(path_);
+    fs::create_directories(path_);
+  }
+  ~ScratchDir() { fs::remove_all(path_); }
+
+  const fs::path& path() const { return path_; }
+
+ private:
+  fs::path path_;
+};
+
+// Zero-padded decimal key of exactly `size` bytes (for sizes >= 10).
+std::string MakeKey(int64_t i, size_t size) {
+  std::string digits = std::to_string(i);
+  if (digits.size() >= size) {
+    return digits;
+  }
+  return std::string(size - digits.size(), '0') + digits;
+}
+
+// Random (so incompressible) bytes.
+std::string MakeValue(size_t size, std::mt19937_64& rng) {
+  std::string value(size, '\0');
+  for (char& c : value) {
+    c = static_cast<char>(rng());
+  }
+  return value;
+}
+
+// Writes `num_keys` keys to a Bitcask in `dir` and closes it.
+void Populate(const fs::path& dir, int64_t num_keys, size_t key_size,
+              size_t value_size) {
+  std::mt19937_64 rng(42);
+  auto bc = Bitcask::Open(dir);
+  for (int64_t i = 0; i < num_keys; ++i) {
+    bc.Put(MakeKey(i, key_size), MakeValue(value_size, rng));
+  }
+}
+
+void SetThroughput(benchmark::State& state, size_t bytes_per_op) {
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * bytes_per_op);
+}
+
+// Sizes are {key, value} in bytes.
+void SizeArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"key", "value"})->ArgsProduct({{16, 128}, {64, 1024, 16384}});
+}
+
+// Sizes are {keys, key, value}.
+void KeyCountArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"keys", "key", "value"})
+      ->ArgsProduct({{1'000, 100'000}, {16}, {100, 1024}});
+}
+
+void BM_Put(benchmark::State& state) {
+  const size_t key_size = state.range(0);
+  const size_t value_size = state.range(1);
+  ScratchDir dir;
+  auto bc = Bitcask::Open(dir.path());
+  std::mt19937_64 rng(42);
+  const std::string value = MakeValue(value_size, rng);
+
+  int64_t i = 0;
+  for (auto _ : state) {
+    bc.Put(MakeKey(i++, key_size), value);
+  }
+  SetThroughput(state, key_size + value_size);
+}
+BENCHMARK(BM_Put)->Apply(SizeArgs);
+
+// Overwrites a small set of keys, which is the common case for update-heavy
+// workloads and keeps the KeyDir size constant.
+void BM_PutOverwrite(benchmark::State& state) {
+  const size_t key_size = state.range(0);
+  const size_t value_size = state.range(1);
+  ScratchDir dir;
+  auto bc = Bitcask::Open(dir.path());
+  std::mt19937_64 rng(42);
+  const std::string value = MakeValue(value_size, rng);
+
+  int64_t i = 0;
+  for (auto _ : state) {
+    bc.Put(MakeKey(i++ % 1024, key_size), value);
+  }
+  SetThroughput(state, key_size + value_size);
+}
+BENCHMARK(BM_PutOverwrite)->Apply(SizeArgs);
+
+void BM_GetHot(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+  auto bc = Bitcask::Open(dir.path());
+  std::mt19937_64 rng(7);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bc.Get(MakeKey(rng() % num_keys, key_size)));
+  }
+  SetThroughput(state, key_size + value_size);
+}
+BENCHMARK(BM_GetHot)->Apply(KeyCountArgs);
+
+// As `BM_GetHot`, with a value cache large enough for every value.
+void BM_GetCached(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+  auto bc = Bitcask::Open(
+      dir.path(),
+      {.value_cache_bytes = 2 * num_keys * (key_size + value_size + 128)});
+  std::mt19937_64 rng(7);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bc.Get(MakeKey(rng() % num_keys, key_size)));
+  }
+  SetThroughput(state, key_size + value_size);
+}
+BENCHMARK(BM_GetCached)->Apply(KeyCountArgs);
+
+void BM_GetCold(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+  auto bc = Bitcask::Open(dir.path());
+  std::mt19937_64 rng(7);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    workload::DropPageCache(dir.path());
+    std::string key = MakeKey(rng() % num_keys, key_size);
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(bc.Get(key));
+  }
+  SetThroughput(state, key_size + value_size);
+}
+BENCHMARK(BM_GetCold)->Apply(KeyCountArgs);
+
+void BM_GetMissing(benchmark::State& state) {
+  ScratchDir dir;
+  Populate(dir.path(), 1'000, 16, 100);
+  auto bc = Bitcask::Open(dir.path());
+
+  for (auto _ : state) {
+    try {
+      bc.Get("not_a_key");
+    } catch (const MissingKeyException&) {
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetMissing);
+
+void BM_Delete(benchmark::State& state) {
+  const size_t key_size = state.range(0);
+  const size_t value_size = state.range(1);
+  ScratchDir dir;
+  auto bc = Bitcask::Open(dir.path());
+  std::mt19937_64 rng(42);
+  const std::string value = MakeValue(value_size, rng);
+
+  int64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::string key = MakeKey(i++, key_size);
+    bc.Put(key, value);
+    state.ResumeTiming();
+
+    bc.Delete(key);
+  }
+  // Only the tombstone (header + key) is written.
+  SetThroughput(state, key_size);
+}
+BENCHMARK(BM_Delete)->Apply(SizeArgs);
+
+void BM_ListKeys(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+  auto bc = Bitcask::Open(dir.path());
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bc.ListKeys());
+  }
+  // Items are keys listed rather than calls.
+  state.SetItemsProcessed(state.iterations() * num_keys);
+  state.SetBytesProcessed(state.iterations() * num_keys * key_size);
+}
+BENCHMARK(BM_ListKeys)->Apply(KeyCountArgs);
+
+void BM_Fold(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+  auto bc = Bitcask::Open(dir.path());
+
+  for (auto _ : state) {
+    size_t total = 0;
+    bc.Fold([&](const std::string&, const std::string& value) {
+      total += value.size();
+    });
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(state.iterations() * num_keys);
+  state.SetBytesProcessed(state.iterations() * num_keys *
+                          (key_size + value_size));
+}
+BENCHMARK(BM_Fold)->Apply(KeyCountArgs);
+
+void BM_Open(benchmark::State& state) {
+  const int64_t num_keys = state.range(0);
+  const size_t key_size = state.range(1);
+  const size_t value_size = state.range(2);
+  ScratchDir dir;
+  Populate(dir.path(), num_keys, key_size, value_size);
+
+  uintmax_t data_size = 0;
+  for (const auto& file_entry : fs::directory_iterator(dir.path())) {
+    data_size += file_entry.file_size();
+  }
+
+  for (auto _ : state) {
+    {
+      auto bc = Bitcask::Open(dir.path());
+      Bitcask* opened = &bc;
+      benchmark::DoNotOptimize(opened);
+    }
+
+    state.PauseTiming();
+    workload::RemoveEmptyFiles(dir.path());
+    state.ResumeTiming();
+  }
+  // Items are entries loaded; bytes are cask file bytes scanned.
+  state.SetItemsProcessed(state.iterations() * num_keys);
+  state.SetBytesProcessed(state.iterations() * data_size);
+}
+BENCHMARK(BM_Open)->Apply(KeyCountArgs)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace rd::bitcask
+
+BENCHMARK_MAIN();
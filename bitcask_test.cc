@@ -4,9 +4,25 @@
 #include <gtest/gtest.h>
 #include <gtest/internal/gtest-internal.h>
 
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 // NOTE: The tests are a little light but stick to the public interface. More
 // robusts tests may be added if this is ever used in an industrial setting...
@@ -16,11 +32,43 @@ namespace {
 
 namespace fs = ::std::filesystem;
 
+using ::testing::Contains;
+using ::testing::ElementsAre;
 using ::testing::TempDir;
 using ::testing::TestInfo;
+using ::testing::Not;
 using ::testing::Throws;
 using ::testing::UnorderedElementsAre;
 
+// Collects the name of every span.
+struct NameSink : public TraceSink {
+  void Record(const TraceEvent& event) override {
+    names.push_back(event.name);
+  }
+  std::vector<std::string> names;
+};
+
+// Makes writes past `bytes` into any file fail with `EFBIG` while in scope.
+class FileSizeLimit {
+ public:
+  explicit FileSizeLimit(rlim_t bytes) {
+    getrlimit(RLIMIT_FSIZE, &saved_limit_);
+    // Otherwise the kernel kills the process instead of failing the write.
+    saved_handler_ = std::signal(SIGXFSZ, SIG_IGN);
+    rlimit limit = saved_limit_;
+    limit.rlim_cur = bytes;
+    setrlimit(RLIMIT_FSIZE, &limit);
+  }
+  ~FileSizeLimit() {
+    setrlimit(RLIMIT_FSIZE, &saved_limit_);
+    std::signal(SIGXFSZ, saved_handler_);
+  }
+
+ private:
+  rlimit saved_limit_;
+  void (*saved_handler_)(int);
+};
+
 class BitcaskTest : public testing::Test {
  protected:
   BitcaskTest() {
@@ -88,6 +136,384 @@ TEST_F(BitcaskTest, IgnoresTombstonedEntriesOnLoad) {
   EXPECT_THAT([&]() { bc.Get("Goodbye"); }, Throws<MissingKeyException>());
 }
 
+TEST_F(BitcaskTest, StoresFormerTombstoneValue) {
+  // Deletes used to be encoded as this literal value.
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("Hello", "rdbc_tombstone");
+    EXPECT_EQ(bc.Get("Hello"), "rdbc_tombstone");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_EQ(bc.Get("Hello"), "rdbc_tombstone");
+}
+
+TEST_F(BitcaskTest, CompressesValues) {
+  const std::string compressible(1000, 'a');
+  const std::string incompressible = "short";
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.compression = CodecId::kLz});
+    bc.Put("big", compressible);
+    bc.Put("small", incompressible);
+    EXPECT_EQ(bc.Get("big"), compressible);
+    EXPECT_EQ(bc.Get("small"), incompressible);
+  }
+
+  // The compressed value takes up far less than its raw size on disk.
+  uintmax_t total_size = 0;
+  for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+    total_size += file_entry.file_size();
+  }
+  EXPECT_LT(total_size, compressible.size());
+
+  // Reading doesn't depend on the options used for writing.
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_EQ(bc.Get("big"), compressible);
+  EXPECT_EQ(bc.Get("small"), incompressible);
+}
+
+TEST_F(BitcaskTest, MergesSealedFiles) {
+  for (int i = 0; i < 5; ++i) {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("overwritten", std::to_string(i));
+    bc.Put("key_" + std::to_string(i), "value_" + std::to_string(i));
+  }
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Delete("key_0");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_);
+  bc.Merge();
+
+  // One merged file plus the active one.
+  int cask_count = 0;
+  for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+    cask_count += file_entry.path().extension() == ".cask";
+  }
+  EXPECT_EQ(cask_count, 2);
+
+  EXPECT_EQ(bc.Get("overwritten"), "4");
+  EXPECT_THAT([&]() { bc.Get("key_0"); }, Throws<MissingKeyException>());
+  EXPECT_EQ(bc.Get("key_4"), "value_4");
+
+  // The merged file loads just the same.
+  auto reopened = Bitcask::Open(cask_dir_);
+  EXPECT_THAT(reopened.ListKeys(),
+              UnorderedElementsAre("overwritten", "key_1", "key_2", "key_3",
+                                   "key_4"));
+  EXPECT_EQ(reopened.Get("overwritten"), "4");
+}
+
+TEST_F(BitcaskTest, TrainsDictionaryOnMerge) {
+  auto value_for = [](int i) {
+    return R"({"id": )" + std::to_string(i) +
+           R"(, "status": "active", "region": "us-east-1"})";
+  };
+  const Options options = {.train_dictionary = true, .dictionary_size = 1024};
+  {
+    auto bc = Bitcask::Open(cask_dir_, options);
+    for (int i = 0; i < 500; ++i) {
+      bc.Put("key_" + std::to_string(i), value_for(i));
+    }
+  }
+  uintmax_t unmerged_size = 0;
+  for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+    unmerged_size += file_entry.file_size();
+  }
+
+  {
+    auto bc = Bitcask::Open(cask_dir_, options);
+    bc.Merge();
+    EXPECT_EQ(bc.Get("key_123"), value_for(123));
+  }
+  uintmax_t merged_size = 0;
+  for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+    merged_size += file_entry.file_size();
+  }
+  // Headers and keys dominate what's left, so this is far from the ratio on
+  // the values alone.
+  EXPECT_LT(merged_size * 3, unmerged_size * 2);
+
+  // The dictionary is found again when loading.
+  auto bc = Bitcask::Open(cask_dir_);
+  for (int i = 0; i < 500; ++i) {
+    EXPECT_EQ(bc.Get("key_" + std::to_string(i)), value_for(i));
+  }
+}
+
+TEST_F(BitcaskTest, ExpiresKeys) {
+  using std::chrono::hours;
+  using std::chrono::microseconds;
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("forever", "val");
+    bc.Put("later", "val", hours(1));
+    bc.Put("expired", "old_val");
+    bc.Put("expired", "val", microseconds(1));
+    std::this_thread::sleep_for(microseconds(10));
+
+    EXPECT_EQ(bc.Get("later"), "val");
+    EXPECT_THAT([&]() { bc.Get("expired"); }, Throws<MissingKeyException>());
+    EXPECT_THAT(bc.ListKeys(), UnorderedElementsAre("forever", "later"));
+  }
+
+  // Expiry is persisted, and the expired write still shadows the older value.
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_THAT(bc.ListKeys(), UnorderedElementsAre("forever", "later"));
+  EXPECT_THAT([&]() { bc.Get("expired"); }, Throws<MissingKeyException>());
+
+  bc.Merge();
+  EXPECT_THAT(bc.ListKeys(), UnorderedElementsAre("forever", "later"));
+  EXPECT_EQ(bc.Get("later"), "val");
+}
+
+TEST_F(BitcaskTest, RecordsLatencies) {
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("Hello", "val");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_);
+  bc.Put("Hello", "val");
+  bc.Put("Goodbye", "val");
+  bc.Get("Hello");
+  bc.Delete("Goodbye");
+
+  BitcaskStats stats = bc.Stats();
+  EXPECT_EQ(stats.put_latency.count(), 2);
+  EXPECT_EQ(stats.get_latency.count(), 1);
+  EXPECT_EQ(stats.delete_latency.count(), 1);
+  EXPECT_EQ(stats.flush_latency.count(), 3);
+  // Loading the old file, creating the new one, and reading from it.
+  EXPECT_EQ(stats.file_open_latency.count(), 3);
+  EXPECT_GT(stats.put_latency.max(), 0);
+}
+
+TEST_F(BitcaskTest, TracksCountersAndGauges) {
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("Hello", "val");
+    bc.Put("Overwritten", "val");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_);
+  bc.Put("Overwritten", "new");
+  bc.Put("Goodbye", "val");
+  bc.Delete("Goodbye");
+  bc.Get("Hello");
+  EXPECT_THROW(bc.Get("Goodbye"), MissingKeyException);
+
+  BitcaskStats stats = bc.Stats();
+  EXPECT_EQ(stats.get_hits, 1);
+  EXPECT_EQ(stats.get_misses, 1);
+  EXPECT_EQ(stats.bytes_read, 3);
+  EXPECT_EQ(stats.keydir_entries, 2);
+  EXPECT_GT(stats.keydir_memory_bytes, 0);
+  EXPECT_EQ(stats.cask_files, 2);
+
+  // Each entry is a header, the key and the value.
+  constexpr uint64_t kHeader = 2 * sizeof(int64_t) + 2 * sizeof(size_t) + 2;
+  // "Hello" and the second "Overwritten" are live; the first "Overwritten",
+  // "Goodbye" and its tombstone are dead.
+  EXPECT_EQ(stats.live_bytes, (kHeader + 5 + 3) + (kHeader + 11 + 3));
+  EXPECT_EQ(stats.dead_bytes,
+            (kHeader + 11 + 3) + (kHeader + 7 + 3) + (kHeader + 7));
+  EXPECT_EQ(stats.active_file_bytes,
+            (kHeader + 11 + 3) + (kHeader + 7 + 3) + (kHeader + 7));
+  EXPECT_EQ(stats.bytes_written, stats.active_file_bytes);
+
+  uintmax_t disk_bytes = 0;
+  for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+    disk_bytes += file_entry.file_size();
+  }
+  EXPECT_EQ(stats.live_bytes + stats.dead_bytes, disk_bytes);
+
+  // Merging only leaves the dead entries in the active file.
+  bc.Merge();
+  stats = bc.Stats();
+  EXPECT_EQ(stats.cask_files, 2);
+  EXPECT_EQ(stats.dead_bytes, (kHeader + 7 + 3) + (kHeader + 7));
+
+  std::string text = stats.ToPrometheusText();
+  EXPECT_THAT(text, ::testing::HasSubstr("# TYPE bitcask_gets_total counter\n"
+                                         "bitcask_gets_total 2\n"));
+  EXPECT_THAT(text, ::testing::HasSubstr("bitcask_keydir_entries 2\n"));
+  EXPECT_THAT(text, ::testing::HasSubstr(
+                        "bitcask_put_latency_seconds_count 2\n"));
+}
+
+TEST_F(BitcaskTest, TracesOperations) {
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("Hello", "val");
+  }
+
+  auto sink = std::make_shared<NameSink>();
+  auto bc = Bitcask::Open(cask_dir_, {.trace_sink = sink});
+  EXPECT_THAT(sink->names,
+              ElementsAre("Open.ScanDirectory", "Open.ScanFile",
+                          "Open.TrackKeyDir", "Open"));
+
+  sink->names.clear();
+  bc.Put("Hello", "val");
+  // The first append reserves space for the next few too.
+  EXPECT_THAT(sink->names,
+              ElementsAre("Put.Encode", "Append.Preallocate", "Append.Write",
+                          "Put.UpdateKeyDir", "Append.Flush", "Put"));
+
+  sink->names.clear();
+  bc.Put("Hello", "val");
+  EXPECT_THAT(sink->names, ElementsAre("Put.Encode", "Append.Write",
+                                       "Put.UpdateKeyDir", "Append.Flush",
+                                       "Put"));
+
+  sink->names.clear();
+  bc.Get("Hello");
+  EXPECT_THAT(sink->names, ElementsAre("Get.Lookup", "Get.OpenFile",
+                                       "Get.Read", "Get.Decode", "Get"));
+}
+
+TEST_F(BitcaskTest, EnforcesKeyDirMemoryBudget) {
+  constexpr size_t kBudget = 16 * 1024;
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.keydir_memory_budget = kBudget});
+    int num_keys = 0;
+    try {
+      for (;; ++num_keys) {
+        bc.Put("a_key_too_long_to_be_inlined_" + std::to_string(num_keys),
+               "val");
+      }
+    } catch (const KeyDirFullException&) {
+    }
+    EXPECT_GT(num_keys, 10);
+    EXPECT_LE(bc.Stats().keydir_memory_bytes, kBudget);
+    EXPECT_EQ(bc.Stats().keydir_entries, num_keys);
+
+    // Rejected keys aren't written, but existing keys can still be
+    // overwritten.
+    EXPECT_THROW(bc.Get("a_key_too_long_to_be_inlined_" +
+                        std::to_string(num_keys)),
+                 MissingKeyException);
+    bc.Put("a_key_too_long_to_be_inlined_0", "new");
+    EXPECT_EQ(bc.Get("a_key_too_long_to_be_inlined_0"), "new");
+  }
+
+  EXPECT_THROW(Bitcask::Open(cask_dir_, {.keydir_memory_budget = kBudget / 2}),
+               KeyDirFullException);
+  auto bc = Bitcask::Open(cask_dir_, {.keydir_memory_budget = kBudget});
+  EXPECT_EQ(bc.Get("a_key_too_long_to_be_inlined_0"), "new");
+}
+
+TEST_F(BitcaskTest, DropsExpiredKeysWhenKeyDirIsFull) {
+  auto bc = Bitcask::Open(
+      cask_dir_, {.keydir_memory_budget = 16 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kDropExpired});
+  int num_keys = 0;
+  try {
+    for (;; ++num_keys) {
+      bc.Put("key_" + std::to_string(num_keys), "val",
+             std::chrono::milliseconds(200));
+    }
+  } catch (const KeyDirFullException&) {
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  bc.Put("key_" + std::to_string(num_keys), "val");
+  EXPECT_EQ(bc.Stats().keydir_entries, 1);
+}
+
+TEST_F(BitcaskTest, SpillsColdKeysWhenKeyDirIsFull) {
+  constexpr size_t kBudget = 16 * 1024;
+  constexpr int kNumKeys = 2000;
+  const Options options = {.keydir_memory_budget = kBudget,
+                           .keydir_full_policy = KeyDirFullPolicy::kSpill};
+  {
+    auto bc = Bitcask::Open(cask_dir_, options);
+    for (int i = 0; i < kNumKeys; ++i) {
+      bc.Put("key_" + std::to_string(i), "val_" + std::to_string(i));
+    }
+    EXPECT_LE(bc.Stats().keydir_memory_bytes, kBudget);
+    EXPECT_EQ(bc.Stats().keydir_entries, kNumKeys);
+    EXPECT_GT(bc.Stats().keydir_spilled_entries, kNumKeys / 2);
+    EXPECT_EQ(bc.ListKeys().size(), kNumKeys);
+
+    // Spilled keys can be read, overwritten and deleted.
+    EXPECT_EQ(bc.Get("key_0"), "val_0");
+    bc.Put("key_1", "new");
+    EXPECT_EQ(bc.Get("key_1"), "new");
+    bc.Delete("key_2");
+    EXPECT_THROW(bc.Get("key_2"), MissingKeyException);
+    EXPECT_EQ(bc.Stats().keydir_entries, kNumKeys - 1);
+  }
+
+  // Spilled entries are rewritten by a merge, and rebuilt by `Open`.
+  {
+    auto bc = Bitcask::Open(cask_dir_, options);
+    bc.Merge();
+    EXPECT_EQ(bc.Get("key_1"), "new");
+    EXPECT_EQ(bc.Get("key_3"), "val_3");
+    EXPECT_EQ(bc.Stats().dead_bytes, 0);
+  }
+  auto bc = Bitcask::Open(cask_dir_, options);
+  EXPECT_EQ(bc.Stats().keydir_entries, kNumKeys - 1);
+  EXPECT_THROW(bc.Get("key_2"), MissingKeyException);
+  for (int i = 3; i < kNumKeys; ++i) {
+    ASSERT_EQ(bc.Get("key_" + std::to_string(i)), "val_" + std::to_string(i));
+  }
+}
+
+TEST_F(BitcaskTest, PutsSpilledKeysBackInMemory) {
+  auto sink = std::make_shared<NameSink>();
+  auto bc = Bitcask::Open(
+      cask_dir_, {.trace_sink = sink,
+                  .keydir_memory_budget = 16 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kSpill});
+  for (int i = 0; i < 1000; ++i) {
+    bc.Put("key_" + std::to_string(i), "val");
+  }
+  // `ListKeys` lists the keys in memory first.
+  ASSERT_GT(bc.Stats().keydir_spilled_entries, 0);
+  const std::string spilled = bc.ListKeys().back();
+
+  bc.Put(spilled, "new");
+  sink->names.clear();
+  EXPECT_EQ(bc.Get(spilled), "new");
+  EXPECT_THAT(sink->names, Not(Contains("Get.ReadSpilled")));
+  EXPECT_EQ(bc.Stats().keydir_entries, 1000);
+}
+
+TEST_F(BitcaskTest, ReadsSpilledKeysBackInMemory) {
+  auto sink = std::make_shared<NameSink>();
+  auto bc = Bitcask::Open(
+      cask_dir_, {.trace_sink = sink,
+                  .keydir_memory_budget = 16 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kSpill});
+  for (int i = 0; i < 1000; ++i) {
+    bc.Put("key_" + std::to_string(i), "val_" + std::to_string(i));
+  }
+  // `ListKeys` lists the keys in memory first.
+  ASSERT_GT(bc.Stats().keydir_spilled_entries, 0);
+  const std::string spilled = bc.ListKeys().back();
+
+  // A hot key comes back into memory, and stays there while the rest of the
+  // spilled keys are read once each.
+  sink->names.clear();
+  const std::string value = bc.Get(spilled);
+  EXPECT_THAT(sink->names, Contains("Get.Promote"));
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 10 == 0) {
+      bc.Get(spilled);
+    }
+    bc.Get("key_" + std::to_string(i));
+  }
+  sink->names.clear();
+  EXPECT_EQ(bc.Get(spilled), value);
+  EXPECT_THAT(sink->names, Not(Contains("Get.ReadSpilled")));
+  EXPECT_LE(bc.Stats().keydir_memory_bytes, 16 * 1024);
+  EXPECT_EQ(bc.Stats().keydir_entries, 1000);
+}
+
 TEST_F(BitcaskTest, LoadsFromMultipleFiles) {
   constexpr int num_casks = 10;
 
@@ -128,5 +554,458 @@ TEST_F(BitcaskTest, ListKeys) {
   EXPECT_THAT(keys, UnorderedElementsAre("Hello", "123", ""));
 }
 
+TEST_F(BitcaskTest, ListsKeysInChunks) {
+  constexpr int kNumKeys = 1000;
+  auto bc = Bitcask::Open(
+      cask_dir_, {.keydir_memory_budget = 16 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kSpill});
+  for (int i = 0; i < kNumKeys; ++i) {
+    bc.Put("key_" + std::to_string(i), "val");
+  }
+  ASSERT_GT(bc.Stats().keydir_spilled_entries, 0);
+
+  // Writes between chunks don't hide keys that were there all along.
+  std::set<std::string> listed;
+  KeyCursor cursor;
+  int chunks = 0;
+  while (!cursor.done()) {
+    std::vector<std::string> chunk = bc.NextKeys(cursor, 50);
+    listed.insert(chunk.begin(), chunk.end());
+    bc.Put("key_" + std::to_string(chunks), "new");
+    bc.Put("added_" + std::to_string(chunks), "val");
+    bc.Delete("key_" + std::to_string(kNumKeys - 1 - chunks));
+    ++chunks;
+  }
+  EXPECT_GT(chunks, kNumKeys / 50);
+  for (int i = 0; i < kNumKeys - chunks; ++i) {
+    EXPECT_EQ(listed.count("key_" + std::to_string(i)), 1) << i;
+  }
+  EXPECT_TRUE(bc.NextKeys(cursor, 50).empty());
+}
+
+TEST_F(BitcaskTest, FoldsOverLiveEntries) {
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.compression = CodecId::kLz});
+    bc.Put("overwritten", "old");
+    bc.Put("deleted", "val");
+    bc.Put("compressed", std::string(1000, 'a'));
+  }
+  auto bc = Bitcask::Open(
+      cask_dir_, {.keydir_memory_budget = 4 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kSpill});
+  bc.Put("overwritten", "new");
+  bc.Delete("deleted");
+  bc.Put("expired", "val", std::chrono::microseconds(1));
+  for (int i = 0; i < 100; ++i) {
+    bc.Put("key_" + std::to_string(i), std::to_string(i));
+  }
+  ASSERT_GT(bc.Stats().keydir_spilled_entries, 0);
+  std::this_thread::sleep_for(std::chrono::microseconds(10));
+
+  std::map<std::string, std::string> folded;
+  bc.Fold([&](const std::string& key, const std::string& value) {
+    EXPECT_TRUE(folded.emplace(key, value).second) << key;
+  });
+  EXPECT_EQ(folded.size(), 102);
+  EXPECT_EQ(folded["overwritten"], "new");
+  EXPECT_EQ(folded["compressed"], std::string(1000, 'a'));
+  EXPECT_EQ(folded["key_42"], "42");
+  EXPECT_EQ(folded.count("deleted"), 0);
+  EXPECT_EQ(folded.count("expired"), 0);
+}
+
+TEST_F(BitcaskTest, ReadsFromSnapshots) {
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.compression = CodecId::kLz});
+    bc.Put("overwritten", "old");
+    bc.Put("deleted", "val");
+    bc.Put("compressed", std::string(1000, 'a'));
+  }
+  auto bc = Bitcask::Open(cask_dir_);
+  bc.Put("added_before", "val");
+  BitcaskSnapshot snapshot = bc.Snapshot();
+
+  bc.Put("overwritten", "new");
+  bc.Delete("deleted");
+  bc.Put("added_after", "val");
+  // The merge can't delete the files the snapshot reads from.
+  bc.Merge();
+
+  EXPECT_EQ(snapshot.Get("overwritten"), "old");
+  EXPECT_EQ(snapshot.Get("deleted"), "val");
+  EXPECT_EQ(snapshot.Get("compressed"), std::string(1000, 'a'));
+  EXPECT_THAT([&]() { snapshot.Get("added_after"); },
+              Throws<MissingKeyException>());
+  EXPECT_THAT(snapshot.ListKeys(),
+              UnorderedElementsAre("overwritten", "deleted", "compressed",
+                                   "added_before"));
+  std::map<std::string, std::string> folded;
+  snapshot.Fold([&](const std::string& key, const std::string& value) {
+    folded[key] = value;
+  });
+  EXPECT_EQ(folded.size(), 4);
+  EXPECT_EQ(folded["overwritten"], "old");
+
+  EXPECT_EQ(bc.Get("overwritten"), "new");
+  EXPECT_THAT([&]() { bc.Get("deleted"); }, Throws<MissingKeyException>());
+
+  // Merged files go once the last snapshot reading them does.
+  auto count_casks = [&] {
+    int cask_count = 0;
+    for (const auto& file_entry : fs::directory_iterator(cask_dir_)) {
+      cask_count += file_entry.path().extension() == ".cask";
+    }
+    return cask_count;
+  };
+  EXPECT_EQ(count_casks(), 3);
+  BitcaskSnapshot copy = snapshot;
+  snapshot = bc.Snapshot();
+  EXPECT_EQ(count_casks(), 3);
+  copy = snapshot;
+  EXPECT_EQ(count_casks(), 2);
+}
+
+TEST_F(BitcaskTest, ReadsSpilledKeysFromSnapshots) {
+  auto sink = std::make_shared<NameSink>();
+  auto bc = Bitcask::Open(
+      cask_dir_, {.trace_sink = sink,
+                  .keydir_memory_budget = 16 * 1024,
+                  .keydir_full_policy = KeyDirFullPolicy::kSpill});
+  for (int i = 0; i < 1000; ++i) {
+    bc.Put("key_" + std::to_string(i), "val_" + std::to_string(i));
+  }
+  // `ListKeys` lists the keys in memory first.
+  ASSERT_GT(bc.Stats().keydir_spilled_entries, 0);
+  const std::string spilled = bc.ListKeys().back();
+  // Not read with `Get`, which would bring it back into memory.
+  const std::string spilled_value = "val_" + spilled.substr(4);
+  BitcaskSnapshot snapshot = bc.Snapshot();
+
+  // Nothing was written since, so this shares the first snapshot's copy.
+  sink->names.clear();
+  BitcaskSnapshot unchanged = bc.Snapshot();
+  EXPECT_THAT(sink->names, Not(Contains("Snapshot.Copy")));
+
+  bc.Put(spilled, "new");
+  bc.Delete(bc.ListKeys().back());
+  EXPECT_EQ(snapshot.Get(spilled), spilled_value);
+  EXPECT_EQ(unchanged.Get(spilled), spilled_value);
+  EXPECT_THROW(snapshot.Get("key_1000"), MissingKeyException);
+  EXPECT_EQ(snapshot.ListKeys().size(), 1000);
+  std::map<std::string, std::string> folded;
+  snapshot.Fold([&](const std::string& key, const std::string& value) {
+    folded[key] = value;
+  });
+  ASSERT_EQ(folded.size(), 1000);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(folded["key_" + std::to_string(i)], "val_" + std::to_string(i));
+  }
+
+  sink->names.clear();
+  EXPECT_EQ(bc.Snapshot().ListKeys().size(), 999);
+  EXPECT_THAT(sink->names, Contains("Snapshot.Copy"));
+}
+
+TEST_F(BitcaskTest, Checkpoints) {
+  const fs::path checkpoint_dir = cask_dir_ / "checkpoint";
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    bc.Put("sealed", "val");
+  }
+  auto bc = Bitcask::Open(cask_dir_);
+  bc.Put("active", "val");
+  bc.Checkpoint(checkpoint_dir);
+  EXPECT_THROW(bc.Checkpoint(checkpoint_dir), std::invalid_argument);
+
+  // Later changes, even merges, don't reach the checkpoint.
+  bc.Put("active", "new");
+  bc.Delete("sealed");
+  bc.Put("later", "val");
+  bc.Merge();
+  EXPECT_EQ(bc.Get("active"), "new");
+
+  std::ifstream manifest(checkpoint_dir / "MANIFEST");
+  std::string file_name;
+  int file_count = 0;
+  for (uintmax_t size; manifest >> file_name >> size; ++file_count) {
+    EXPECT_EQ(fs::file_size(checkpoint_dir / file_name), size);
+  }
+  EXPECT_EQ(file_count, 2);
+
+  auto checkpoint = Bitcask::Open(checkpoint_dir);
+  EXPECT_THAT(checkpoint.ListKeys(), UnorderedElementsAre("sealed", "active"));
+  EXPECT_EQ(checkpoint.Get("active"), "val");
+}
+
+TEST_F(BitcaskTest, ScansKeysInOrder) {
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.ordered_index = true});
+    bc.Put("b", "val");
+    bc.Put("ab", "val");
+    bc.Put("a", "val");
+    bc.Put("abc", "val");
+    bc.Put("gone", "val");
+    bc.Delete("gone");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_, {.ordered_index = true});
+  bc.Put("c", "val");
+  EXPECT_THAT(bc.Scan("a", "c"), ElementsAre("a", "ab", "abc", "b"));
+  EXPECT_THAT(bc.Scan("aa", "b"), ElementsAre("ab", "abc"));
+  EXPECT_THAT(bc.Scan("a", "c", 2), ElementsAre("a", "ab"));
+  EXPECT_THAT(bc.PrefixScan("ab"), ElementsAre("ab", "abc"));
+  EXPECT_THAT(bc.PrefixScan(""), ElementsAre("a", "ab", "abc", "b", "c"));
+
+  bc.Delete("ab");
+  bc.Put("abc", "new");
+  EXPECT_THAT(bc.PrefixScan("a"), ElementsAre("a", "abc"));
+
+  auto unordered = Bitcask::Open(cask_dir_ / "unordered");
+  EXPECT_THROW(unordered.Scan("a", "b"), std::logic_error);
+  EXPECT_THROW(
+      Bitcask::Open(cask_dir_, {.keydir_memory_budget = 1024,
+                                .keydir_full_policy = KeyDirFullPolicy::kSpill,
+                                .ordered_index = true}),
+      std::invalid_argument);
+}
+
+TEST_F(BitcaskTest, WritesFromManyThreadsOnTheWriterThread) {
+  constexpr int kThreads = 4;
+  constexpr int kKeysEach = 200;
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.writer_thread = true});
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < kKeysEach; ++i) {
+          std::string key = std::to_string(t) + "_" + std::to_string(i);
+          bc.Put(key, "old");
+          bc.Put(key, key);
+          // Each Put is done by the time it returns.
+          EXPECT_EQ(bc.Get(key), key);
+          if (i % 2 == 1) {
+            bc.Delete(key);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    EXPECT_EQ(bc.ListKeys().size(), kThreads * kKeysEach / 2);
+  }
+
+  // Writes in the same microsecond still load in order.
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_EQ(bc.ListKeys().size(), kThreads * kKeysEach / 2);
+  EXPECT_EQ(bc.Get("0_0"), "0_0");
+  EXPECT_THROW(bc.Get("0_1"), MissingKeyException);
+
+  // Errors reach the thread that made the write.
+  auto full = Bitcask::Open(cask_dir_ / "full", {.keydir_memory_budget = 1,
+                                                 .writer_thread = true});
+  EXPECT_THROW(full.Put("key", "val"), KeyDirFullException);
+}
+
+// Returns the `errno` of `fallocate(FALLOC_FL_KEEP_SIZE)` on a scratch file in
+// `dir`, or 0 if it works.
+int PreallocationError(const fs::path& dir) {
+#ifdef __linux__
+  fs::path scratch = dir / "fallocate_probe";
+  int fd = open(scratch.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+  int error = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 4096) == 0 ? 0 : errno;
+  close(fd);
+  fs::remove(scratch);
+  return error;
+#else
+  (void)dir;
+  return ENOSYS;
+#endif
+}
+
+TEST_F(BitcaskTest, PreallocatesActiveFile) {
+  // Where preallocation isn't supported, `Bitcask` just appends as usual.
+  if (int error = PreallocationError(cask_dir_);
+      error == EOPNOTSUPP || error == ENOSYS) {
+    GTEST_SKIP() << "fallocate: " << std::strerror(error);
+  }
+  constexpr size_t kExtent = 1024 * 1024;
+  // Bytes of disk allocated to `path`.
+  auto allocated = [](const fs::path& path) {
+    struct stat st;
+    EXPECT_EQ(stat(path.c_str(), &st), 0);
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+  };
+  fs::path active_file;
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.preallocate_bytes = kExtent});
+    bc.Put("key", "val");
+    for (const auto& entry : fs::directory_iterator(cask_dir_)) {
+      active_file = entry.path();
+    }
+    // The reserved space isn't part of the file.
+    EXPECT_LT(fs::file_size(active_file), 64);
+    EXPECT_GE(allocated(active_file), kExtent);
+  }
+
+  // Sealing gives back what wasn't used.
+  EXPECT_LT(allocated(active_file), kExtent);
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_EQ(bc.Get("key"), "val");
+}
+
+TEST_F(BitcaskTest, OverwritesKeysWrittenAheadOfTheClock) {
+  // A file whose only entry is timestamped an hour ahead, as if a burst of
+  // writes had run ahead of the clock before a restart. Laid out as
+  // `Bitcask::CaskEntry` is serialized.
+  {
+    std::ofstream output(cask_dir_ / "1.cask", std::ios::binary);
+    auto write = [&](const auto& field) {
+      output.write(reinterpret_cast<const char*>(&field), sizeof(field));
+    };
+    const std::string key = "key";
+    const std::string value = "ahead";
+    write(std::chrono::duration_cast<std::chrono::microseconds>(
+              (std::chrono::system_clock::now() + std::chrono::hours(1))
+                  .time_since_epoch())
+              .count());
+    write(int64_t{0});
+    write(key.size());
+    write(value.size());
+    write(uint8_t{0});
+    write(CodecId::kNone);
+    output << key << value;
+  }
+  {
+    auto bc = Bitcask::Open(cask_dir_);
+    EXPECT_EQ(bc.Get("key"), "ahead");
+    bc.Put("key", "new");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_);
+  EXPECT_EQ(bc.Get("key"), "new");
+}
+
+TEST_F(BitcaskTest, KeepsWorkingAfterAFailedAppend) {
+  for (bool direct_io : {false, true}) {
+    SCOPED_TRACE(direct_io ? "direct_io" : "buffered");
+    fs::remove_all(cask_dir_);
+    fs::create_directories(cask_dir_);
+    {
+      auto bc = Bitcask::Open(cask_dir_, {.direct_io = direct_io});
+      bc.Put("before", "val");
+      {
+        // Part of the value (and, with direct I/O, the first full buffer)
+        // is written before the limit is hit.
+        FileSizeLimit limit(3 << 19);
+        EXPECT_THROW(bc.Put("failed", std::string(3 << 20, 'x')),
+                     std::system_error);
+      }
+      bc.Put("after", "val");
+      EXPECT_EQ(bc.Get("before"), "val");
+      EXPECT_EQ(bc.Get("after"), "val");
+      EXPECT_THROW(bc.Get("failed"), MissingKeyException);
+    }
+
+    auto bc = Bitcask::Open(cask_dir_);
+    EXPECT_EQ(bc.Get("before"), "val");
+    EXPECT_EQ(bc.Get("after"), "val");
+    EXPECT_THROW(bc.Get("failed"), MissingKeyException);
+  }
+}
+
+TEST_F(BitcaskTest, FailsWritesAfterAFailedGroupCommit) {
+  auto bc = Bitcask::Open(cask_dir_, {.writer_thread = true});
+  bc.Put("before", "val");
+  {
+    // Small enough to be buffered, so it's the batch's flush that fails.
+    FileSizeLimit limit(1);
+    EXPECT_THROW(bc.Put("failed", "val"), std::system_error);
+  }
+  // The file may be torn, so the writer takes nothing more.
+  EXPECT_THROW(bc.Put("after", "val"), std::system_error);
+  EXPECT_THROW(bc.Delete("before"), std::system_error);
+  EXPECT_EQ(bc.Get("before"), "val");
+}
+
+TEST_F(BitcaskTest, WritesWithDirectIo) {
+  {
+    auto bc = Bitcask::Open(cask_dir_, {.direct_io = true});
+    bc.Put("key", "val");
+    bc.Put("other", std::string(10000, 'x'));
+    EXPECT_EQ(bc.Get("key"), "val");
+    bc.Delete("other");
+    bc.Merge();
+    bc.Put("key", "new");
+  }
+
+  auto bc = Bitcask::Open(cask_dir_, {.direct_io = true});
+  EXPECT_EQ(bc.Get("key"), "new");
+  EXPECT_THROW(bc.Get("other"), MissingKeyException);
+}
+
+TEST_F(BitcaskTest, CachesValues) {
+  auto bc = Bitcask::Open(cask_dir_, {.compression = CodecId::kLz,
+                                      .compression_min_size = 0,
+                                      .value_cache_bytes = 64 * 1024});
+  bc.Put("key", "val");
+  EXPECT_EQ(bc.Get("key"), "val");
+  EXPECT_EQ(bc.Get("key"), "val");
+  EXPECT_EQ(bc.Stats().value_cache_hits, 1);
+  EXPECT_GT(bc.Stats().value_cache_bytes, 0);
+
+  // Writes invalidate.
+  bc.Put("key", "new");
+  EXPECT_EQ(bc.Get("key"), "new");
+  EXPECT_EQ(bc.Get("key"), "new");
+  bc.Delete("key");
+  EXPECT_THROW(bc.Get("key"), MissingKeyException);
+  bc.Put("key", "again");
+  EXPECT_EQ(bc.Get("key"), "again");
+  EXPECT_EQ(bc.Stats().value_cache_hits, 2);
+
+  // Merges move values without changing them.
+  bc.Merge();
+  EXPECT_EQ(bc.Get("key"), "again");
+  EXPECT_EQ(bc.Stats().value_cache_hits, 3);
+}
+
+#ifdef RD_BITCASK_HAS_COROUTINES
+// Coroutine that starts straight away and fulfills `done` when it finishes.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached PutGetDelete(Bitcask& bc, std::promise<std::string>& done) {
+  co_await bc.PutAsync("key", "val");
+  std::string value = co_await bc.GetAsync("key");
+  co_await bc.DeleteAsync("key");
+  try {
+    co_await bc.GetAsync("key");
+  } catch (const MissingKeyException&) {
+    value += " deleted";
+  }
+  done.set_value(value);
+}
+
+TEST_F(BitcaskTest, AwaitsAsyncOperations) {
+  for (bool writer_thread : {false, true}) {
+    auto bc = Bitcask::Open(cask_dir_, {.writer_thread = writer_thread});
+    std::promise<std::string> done;
+    PutGetDelete(bc, done);
+    EXPECT_EQ(done.get_future().get(), "val deleted");
+  }
+}
+#endif  // RD_BITCASK_HAS_COROUTINES
+
 }  // namespace
 }  // namespace rd::bitcask
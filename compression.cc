@@ -0,0 +1,349 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 12;
+constexpr uint32_t kEmptySlot = UINT32_MAX;
+// Most output a byte of compressed input can decode to: each 255 byte of a
+// match's length extension adds that many bytes.
+constexpr size_t kMaxExpansion = 255;
+
+uint32_t Load32(const char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t Hash(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+void PutVarint(size_t v, std::string* output) {
+  while (v >= 0x80) {
+    output->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  output->push_back(static_cast<char>(v));
+}
+
+// Reads a varint from `input` starting at `*pos`, advancing `*pos`.
+size_t GetVarint(std::string_view input, size_t* pos) {
+  size_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*pos >= input.size()) {
+      throw CorruptValueException("Truncated varint");
+    }
+    uint8_t byte = input[(*pos)++];
+    v |= size_t{byte & 0x7fu} << shift;
+    if (!(byte & 0x80)) {
+      return v;
+    }
+  }
+  throw CorruptValueException("Varint too long");
+}
+
+void PutLength(size_t length, std::string* output) {
+  while (length >= 255) {
+    output->push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  output->push_back(static_cast<char>(length));
+}
+
+size_t GetLength(std::string_view input, size_t* pos) {
+  size_t length = 0;
+  uint8_t byte;
+  do {
+    if (*pos >= input.size()) {
+      throw CorruptValueException("Truncated length");
+    }
+    byte = input[(*pos)++];
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+// Emits a single sequence. `match_length` of 0 marks the final (literal-only)
+// sequence.
+void PutSequence(const char* literals, size_t literal_length, size_t offset,
+                 size_t match_length, std::string* output) {
+  size_t match_code = match_length ? match_length - kMinMatch : 0;
+  uint8_t token = (std::min<size_t>(literal_length, 15) << 4) |
+                  std::min<size_t>(match_code, 15);
+  output->push_back(static_cast<char>(token));
+  if (literal_length >= 15) {
+    PutLength(literal_length - 15, output);
+  }
+  output->append(literals, literal_length);
+  if (match_length == 0) {
+    return;
+  }
+  output->push_back(static_cast<char>(offset & 0xff));
+  output->push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15) {
+    PutLength(match_code - 15, output);
+  }
+}
+
+// Indexed by `CodecId`. Entries are never freed, so the raw pointers handed
+// out by `GetCodec` stay valid even if a codec is re-registered.
+std::array<std::atomic<const Codec*>, 256>& Registry() {
+  static auto* registry = [] {
+    auto* r = new std::array<std::atomic<const Codec*>, 256>{};
+    (*r)[static_cast<uint8_t>(CodecId::kLz)] = new LzCodec();
+    return r;
+  }();
+  return *registry;
+}
+
+// Returns a match-finder table populated with every position of `history`.
+std::vector<uint32_t> PrimeTable(std::string_view history) {
+  std::vector<uint32_t> table(size_t{1} << kHashBits, kEmptySlot);
+  for (size_t pos = 0; pos + kMinMatch <= history.size(); ++pos) {
+    table[Hash(Load32(history.data() + pos))] = pos;
+  }
+  return table;
+}
+
+// Compresses `window[start:]`, allowing matches to reach back into
+// `window[:start]`. `table` must have been primed with `window[:start]`.
+void LzCompress(std::string_view window, size_t start,
+                std::vector<uint32_t> table, std::string* output) {
+  PutVarint(window.size() - start, output);
+
+  const char* base = window.data();
+  size_t end = window.size();
+
+  size_t pos = start;
+  size_t anchor = start;
+  while (pos + kMinMatch <= end) {
+    uint32_t& slot = table[Hash(Load32(base + pos))];
+    size_t candidate = slot;
+    slot = pos;
+
+    if (candidate == kEmptySlot || pos - candidate > kMaxOffset ||
+        Load32(base + candidate) != Load32(base + pos)) {
+      ++pos;
+      continue;
+    }
+
+    size_t length = kMinMatch;
+    while (pos + length < end && base[candidate + length] == base[pos + length]) {
+      ++length;
+    }
+    PutSequence(base + anchor, pos - anchor, pos - candidate, length, output);
+    pos += length;
+    anchor = pos;
+  }
+  PutSequence(base + anchor, end - anchor, 0, 0, output);
+}
+
+// Decompresses `input` onto `output`, resolving matches that reach past the
+// start of the output against the tail of `history`.
+void LzDecompress(std::string_view history, std::string_view input,
+                  std::string* output) {
+  size_t pos = 0;
+  size_t size = GetVarint(input, &pos);
+  // The size comes straight from disk, so check it's achievable before
+  // trusting it with an allocation.
+  if (size / kMaxExpansion > input.size()) {
+    throw CorruptValueException("Decompressed size out of range");
+  }
+  size_t out_start = output->size();
+  output->reserve(out_start + size);
+
+  while (true) {
+    if (pos >= input.size()) {
+      throw CorruptValueException("Truncated sequence");
+    }
+    uint8_t token = input[pos++];
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15) {
+      literal_length += GetLength(input, &pos);
+    }
+    if (input.size() - pos < literal_length) {
+      throw CorruptValueException("Truncated literals");
+    }
+    output->append(input.data() + pos, literal_length);
+    pos += literal_length;
+
+    // The last sequence has no match.
+    if (pos == input.size()) {
+      break;
+    }
+
+    if (input.size() - pos < 2) {
+      throw CorruptValueException("Truncated offset");
+    }
+    size_t offset = uint8_t(input[pos]) | (size_t{uint8_t(input[pos + 1])} << 8);
+    pos += 2;
+    size_t match_length = (token & 0xf) + kMinMatch;
+    if ((token & 0xf) == 15) {
+      match_length += GetLength(input, &pos);
+    }
+
+    size_t produced = output->size() - out_start;
+    if (offset == 0 || offset > produced + history.size()) {
+      throw CorruptValueException("Match offset out of range");
+    }
+    // Copy byte-by-byte since matches may overlap their own output. Offsets
+    // reaching past the start of the output continue into `history`.
+    for (size_t i = 0; i < match_length; ++i, ++produced) {
+      if (offset > produced) {
+        output->push_back(history[history.size() - (offset - produced)]);
+      } else {
+        output->push_back((*output)[out_start + produced - offset]);
+      }
+    }
+  }
+
+  if (output->size() - out_start != size) {
+    throw CorruptValueException("Decompressed size mismatch");
+  }
+}
+
+// Length of the substrings ("d-mers") dictionary training counts.
+constexpr size_t kDmerSize = 8;
+// Length of the sample segments the dictionary is assembled from.
+constexpr size_t kSegmentSize = 64;
+
+uint64_t DmerAt(std::string_view sample, size_t pos) {
+  uint64_t v;
+  std::memcpy(&v, sample.data() + pos, sizeof(v));
+  return v;
+}
+
+}  // namespace
+
+void LzCodec::Compress(std::string_view input, std::string* output) const {
+  LzCompress(input, 0, PrimeTable({}), output);
+}
+
+void LzCodec::Decompress(std::string_view input, std::string* output) const {
+  LzDecompress({}, input, output);
+}
+
+LzDictCodec::LzDictCodec(std::string dictionary)
+    : dictionary_(std::move(dictionary)) {
+  if (dictionary_.size() > kMaxDictionarySize) {
+    dictionary_.erase(0, dictionary_.size() - kMaxDictionarySize);
+  }
+  primed_table_ = PrimeTable(dictionary_);
+}
+
+void LzDictCodec::Compress(std::string_view input, std::string* output) const {
+  std::string window;
+  window.reserve(dictionary_.size() + input.size());
+  window.append(dictionary_).append(input);
+  LzCompress(window, dictionary_.size(), primed_table_, output);
+}
+
+void LzDictCodec::Decompress(std::string_view input,
+                             std::string* output) const {
+  LzDecompress(dictionary_, input, output);
+}
+
+std::string TrainDictionary(const std::vector<std::string_view>& samples,
+                            size_t max_size) {
+  max_size = std::min(max_size, LzDictCodec::kMaxDictionarySize);
+
+  // Number of samples each d-mer appears in. Counting samples rather than
+  // occurrences favors content shared across values over content that merely
+  // repeats within one (which the codec handles without help).
+  std::unordered_map<uint64_t, uint32_t> frequency;
+  for (std::string_view sample : samples) {
+    std::unordered_set<uint64_t> seen;
+    for (size_t pos = 0; pos + kDmerSize <= sample.size(); ++pos) {
+      if (seen.insert(DmerAt(sample, pos)).second) {
+        ++frequency[DmerAt(sample, pos)];
+      }
+    }
+  }
+
+  struct Segment {
+    std::string_view data;
+    uint64_t score;
+    bool operator<(const Segment& other) const { return score < other.score; }
+  };
+  auto score = [&](std::string_view segment) {
+    uint64_t total = 0;
+    for (size_t pos = 0; pos + kDmerSize <= segment.size(); ++pos) {
+      auto itr = frequency.find(DmerAt(segment, pos));
+      // D-mers seen in a single sample are useless to every other value.
+      if (itr->second > 1) {
+        total += itr->second;
+      }
+    }
+    return total;
+  };
+
+  std::priority_queue<Segment> candidates;
+  for (std::string_view sample : samples) {
+    for (size_t pos = 0; pos < sample.size(); pos += kSegmentSize / 2) {
+      std::string_view segment = sample.substr(pos, kSegmentSize);
+      if (segment.size() < kDmerSize) {
+        break;
+      }
+      candidates.push({segment, score(segment)});
+    }
+  }
+
+  // Greedily take the best segment. Once taken, its d-mers are "covered" and
+  // stop counting towards other segments, so scores are lazily refreshed as
+  // candidates reach the top of the queue.
+  std::vector<std::string_view> picked;
+  size_t picked_size = 0;
+  while (!candidates.empty() && picked_size < max_size) {
+    Segment best = candidates.top();
+    candidates.pop();
+
+    uint64_t current = score(best.data);
+    if (current == 0) {
+      continue;
+    }
+    if (current < best.score) {
+      candidates.push({best.data, current});
+      continue;
+    }
+
+    std::string_view data = best.data.substr(
+        0, std::min(best.data.size(), max_size - picked_size));
+    picked.push_back(data);
+    picked_size += data.size();
+    for (size_t pos = 0; pos + kDmerSize <= data.size(); ++pos) {
+      frequency[DmerAt(data, pos)] = 0;
+    }
+  }
+
+  std::string dictionary;
+  dictionary.reserve(picked_size);
+  for (auto itr = picked.rbegin(); itr != picked.rend(); ++itr) {
+    dictionary.append(*itr);
+  }
+  return dictionary;
+}
+
+const Codec* GetCodec(CodecId id) {
+  return Registry()[static_cast<uint8_t>(id)].load(std::memory_order_acquire);
+}
+
+void RegisterCodec(std::unique_ptr<Codec> codec) {
+  Registry()[static_cast<uint8_t>(codec->id())].store(
+      codec.release(), std::memory_order_release);
+}
+
+}  // namespace rd::bitcask
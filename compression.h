@@ -0,0 +1,116 @@
+// Value compression for Bitcask entries.
+//
+// Every entry records the ID of the codec its value was written with, so
+// codecs can be mixed freely within (and across) cask files. Values are only
+// ever decompressed on the read path - loading the KeyDir never looks at them.
+
+#ifndef RD_BITCASK_COMPRESSION_H_
+#define RD_BITCASK_COMPRESSION_H_
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rd::bitcask {
+
+// Identifies the codec used to encode a value on disk. The numeric values are
+// persisted, so never renumber these.
+enum class CodecId : uint8_t {
+  // Value is stored as-is.
+  kNone = 0,
+  // Built-in LZ77-family codec (see `LzCodec`).
+  kLz = 1,
+  // `LzCodec` primed with the dictionary stored in the value's cask file (see
+  // `LzDictCodec`).
+  kLzDict = 2,
+};
+
+// Exception thrown when a stored value can't be decoded.
+struct CorruptValueException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Interface for value codecs.
+class Codec {
+ public:
+  virtual ~Codec() = default;
+
+  virtual CodecId id() const = 0;
+
+  // Appends the encoded form of `input` to `output`.
+  virtual void Compress(std::string_view input, std::string* output) const = 0;
+
+  // Appends the decoded form of `input` to `output`. Throws
+  // `CorruptValueException` if `input` is malformed.
+  virtual void Decompress(std::string_view input,
+                          std::string* output) const = 0;
+};
+
+// Returns the codec registered under `id`, or nullptr if there isn't one.
+// `CodecId::kNone` has no codec, nor does `CodecId::kLzDict` since it depends
+// on per-file state.
+const Codec* GetCodec(CodecId id);
+
+// Registers `codec` under its ID, replacing any existing registration. This is
+// how non-built-in codecs are plugged in; it must happen before any cask that
+// uses them is read.
+void RegisterCodec(std::unique_ptr<Codec> codec);
+
+// Byte-oriented LZ77 codec in the spirit of LZ4: greedy matching against a
+// single-entry hash table, no entropy coding. Fast in both directions and
+// good at the repeated field names / punctuation found in structured values.
+//
+// Format: varint(uncompressed size) followed by sequences of
+//   token          - high nibble literal length, low nibble match length - 4
+//   [length bytes] - 255-continued extension when a nibble is 15
+//   literals
+//   offset         - 2 bytes little-endian, distance back into the output
+//   [length bytes] - match length extension
+// The final sequence carries literals only.
+class LzCodec : public Codec {
+ public:
+  CodecId id() const override { return CodecId::kLz; }
+  void Compress(std::string_view input, std::string* output) const override;
+  void Decompress(std::string_view input, std::string* output) const override;
+};
+
+// `LzCodec` with a shared dictionary that acts as history preceding every
+// value. Small values rarely repeat themselves, but similar values repeat each
+// other - a dictionary built from a sample of them gives matches to values
+// that would otherwise be nearly incompressible.
+class LzDictCodec : public Codec {
+ public:
+  // Dictionaries larger than this can't be fully addressed by match offsets.
+  static constexpr size_t kMaxDictionarySize = 60 * 1024;
+
+  explicit LzDictCodec(std::string dictionary);
+
+  CodecId id() const override { return CodecId::kLzDict; }
+  void Compress(std::string_view input, std::string* output) const override;
+  void Decompress(std::string_view input, std::string* output) const override;
+
+  const std::string& dictionary() const { return dictionary_; }
+
+ private:
+  std::string dictionary_;
+  // Match-finder hash table pre-populated from `dictionary_`, copied at the
+  // start of each `Compress` rather than rebuilding it every time.
+  std::vector<uint32_t> primed_table_;
+};
+
+// Builds a dictionary of at most `max_size` bytes from `samples`.
+//
+// This is a simplified take on zstd's COVER algorithm: fixed-size segments of
+// the samples are scored by how many *other* samples share their 8-byte
+// substrings, and the best segments are picked greedily (re-scoring as the
+// substrings they cover stop counting). The most valuable segments end up at
+// the end of the dictionary, where match offsets are shortest.
+std::string TrainDictionary(const std::vector<std::string_view>& samples,
+                            size_t max_size);
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_COMPRESSION_H_
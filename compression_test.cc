@@ -0,0 +1,98 @@
+#include "compression.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+std::string RoundTrip(const Codec& codec, const std::string& input) {
+  std::string compressed;
+  codec.Compress(input, &compressed);
+  std::string decompressed;
+  codec.Decompress(compressed, &decompressed);
+  return decompressed;
+}
+
+TEST(LzCodecTest, RoundTrips) {
+  LzCodec codec;
+
+  EXPECT_EQ(RoundTrip(codec, ""), "");
+  EXPECT_EQ(RoundTrip(codec, "a"), "a");
+  EXPECT_EQ(RoundTrip(codec, "abcdabcdabcdabcd"), "abcdabcdabcdabcd");
+
+  // Long literal runs and long (overlapping) matches both need the extended
+  // length encoding.
+  std::string mixed;
+  for (int i = 0; i < 1000; ++i) {
+    mixed += std::to_string(i * 7919);
+  }
+  mixed += std::string(5000, 'z');
+  EXPECT_EQ(RoundTrip(codec, mixed), mixed);
+}
+
+TEST(LzCodecTest, CompressesRepetitiveInput) {
+  LzCodec codec;
+  std::string input;
+  for (int i = 0; i < 100; ++i) {
+    input += R"({"user_id": )" + std::to_string(i) + R"(, "active": true})";
+  }
+
+  std::string compressed;
+  codec.Compress(input, &compressed);
+  EXPECT_LT(compressed.size() * 3, input.size());
+}
+
+TEST(LzCodecTest, RejectsCorruptInput) {
+  LzCodec codec;
+  std::string compressed;
+  codec.Compress(std::string(100, 'x'), &compressed);
+  compressed.resize(compressed.size() - 1);
+
+  std::string output;
+  EXPECT_THROW(codec.Decompress(compressed, &output), CorruptValueException);
+
+  // A size no input this short could decode to is rejected up front, rather
+  // than being reserved.
+  std::string huge_size = "\xff\xff\xff\xff\xff\xff\xff\xff\x7f";
+  huge_size.push_back('\0');
+  EXPECT_THROW(codec.Decompress(huge_size, &output), CorruptValueException);
+}
+
+TEST(LzDictCodecTest, CompressesSmallValuesAgainstDictionary) {
+  std::vector<std::string> values;
+  for (int i = 0; i < 200; ++i) {
+    values.push_back(R"({"name": "user)" + std::to_string(i) +
+                     R"(", "email_verified": false, "plan": "free"})");
+  }
+  std::vector<std::string_view> samples(values.begin(), values.end());
+  std::string dictionary = TrainDictionary(samples, 1024);
+  ASSERT_FALSE(dictionary.empty());
+  EXPECT_LE(dictionary.size(), 1024);
+
+  LzCodec plain;
+  LzDictCodec codec(dictionary);
+  const std::string value = R"({"name": "user9999", "email_verified": false, "plan": "free"})";
+
+  std::string with_dictionary;
+  codec.Compress(value, &with_dictionary);
+  std::string without_dictionary;
+  plain.Compress(value, &without_dictionary);
+  EXPECT_LT(with_dictionary.size() * 2, without_dictionary.size());
+
+  std::string decompressed;
+  codec.Decompress(with_dictionary, &decompressed);
+  EXPECT_EQ(decompressed, value);
+}
+
+TEST(CodecRegistryTest, HasBuiltInCodecs) {
+  EXPECT_EQ(GetCodec(CodecId::kNone), nullptr);
+  ASSERT_NE(GetCodec(CodecId::kLz), nullptr);
+  EXPECT_EQ(GetCodec(CodecId::kLz)->id(), CodecId::kLz);
+}
+
+}  // namespace
+}  // namespace rd::bitcask
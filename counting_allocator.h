@@ -0,0 +1,66 @@
+// Allocator that keeps a running total of the bytes allocated through it.
+//
+// Copies (including rebound ones, e.g. the node and bucket allocators a
+// `std::unordered_map` derives from the allocator it is given) share the same
+// total, so a container's whole footprint - minus whatever its elements
+// allocate themselves - ends up in one counter.
+
+#ifndef RD_BITCASK_COUNTING_ALLOCATOR_H_
+#define RD_BITCASK_COUNTING_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace rd::bitcask {
+
+template <typename T>
+class CountingAllocator {
+ public:
+  using value_type = T;
+  using Counter = std::atomic<size_t>;
+  // Moved/swapped containers take their total with them.
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  // Starts a new total.
+  CountingAllocator() : counter_(std::make_shared<Counter>(0)) {}
+
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>& other)
+      : counter_(other.counter()) {}
+
+  T* allocate(size_t n) {
+    counter_->fetch_add(n * sizeof(T), std::memory_order_relaxed);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    counter_->fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  // Bytes currently allocated through this allocator and its copies.
+  size_t allocated_bytes() const {
+    return counter_->load(std::memory_order_relaxed);
+  }
+
+  const std::shared_ptr<Counter>& counter() const { return counter_; }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>& other) const {
+    return counter_ == other.counter();
+  }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  std::shared_ptr<Counter> counter_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_COUNTING_ALLOCATOR_H_
@@ -0,0 +1,139 @@
+#include "direct_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+
+namespace rd::bitcask {
+namespace {
+
+[[noreturn]] void ThrowErrno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+size_t RoundUp(size_t bytes) {
+  return (bytes + DirectFileWriter::kAlignment - 1) &
+         ~(DirectFileWriter::kAlignment - 1);
+}
+
+}  // namespace
+
+DirectFileWriter::DirectFileWriter(const std::filesystem::path& path,
+                                   size_t buffer_size)
+    : path_(path), capacity_(std::max(RoundUp(buffer_size), kAlignment)) {
+  constexpr int kFlags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  fd_ = open(path_.c_str(), kFlags | O_DIRECT, 0644);
+  if (fd_ < 0 && errno == EINVAL) {
+    fd_ = open(path_.c_str(), kFlags, 0644);
+  }
+  if (fd_ < 0) {
+    ThrowErrno("open " + path_.string());
+  }
+  buffer_.reset(
+      static_cast<char*>(std::aligned_alloc(kAlignment, capacity_)));
+  if (buffer_ == nullptr) {
+    close(fd_);
+    throw std::bad_alloc();
+  }
+}
+
+DirectFileWriter::~DirectFileWriter() {
+  try {
+    Close();
+  } catch (const std::system_error&) {
+    // Nowhere to report it; the file keeps its padding, which `Open` skips.
+  }
+}
+
+void DirectFileWriter::Append(std::string_view data, std::string_view more) {
+  if (data.size() + more.size() <= capacity_ - buffered_) {
+    std::memcpy(buffer_.get() + buffered_, data.data(), data.size());
+    std::memcpy(buffer_.get() + buffered_ + data.size(), more.data(),
+                more.size());
+    buffered_ += data.size() + more.size();
+    return;
+  }
+
+  // Filling the buffer writes it out, taking the partial block in front of
+  // the record with it. Keep a copy to put back if a later write fails.
+  const uint64_t old_offset = file_offset_;
+  const size_t old_buffered = buffered_;
+  const size_t tail = buffered_ & (kAlignment - 1);
+  std::string partial_block(buffer_.get() + buffered_ - tail, tail);
+  try {
+    for (std::string_view part : {data, more}) {
+      while (!part.empty()) {
+        size_t n = std::min(part.size(), capacity_ - buffered_);
+        std::memcpy(buffer_.get() + buffered_, part.data(), n);
+        buffered_ += n;
+        part.remove_prefix(n);
+        if (buffered_ == capacity_) {
+          WriteBuffer(capacity_);
+          file_offset_ += capacity_;
+          buffered_ = 0;
+        }
+      }
+    }
+  } catch (const std::system_error&) {
+    // Whatever of the record reached the file is past `size()` again, and
+    // gets overwritten by the next write.
+    if (file_offset_ == old_offset) {
+      buffered_ = old_buffered;
+    } else {
+      // Everything before the record went out with the first write.
+      file_offset_ = old_offset + old_buffered - tail;
+      std::memcpy(buffer_.get(), partial_block.data(), tail);
+      buffered_ = tail;
+    }
+    throw;
+  }
+}
+
+void DirectFileWriter::Flush() {
+  if (fd_ < 0 || buffered_ == 0) {
+    return;
+  }
+  size_t padded = RoundUp(buffered_);
+  std::memset(buffer_.get() + buffered_, 0, padded - buffered_);
+  WriteBuffer(padded);
+
+  // Keep the partial block for the next flush to write again.
+  size_t whole = buffered_ & ~(kAlignment - 1);
+  std::memmove(buffer_.get(), buffer_.get() + whole, buffered_ - whole);
+  file_offset_ += whole;
+  buffered_ -= whole;
+}
+
+void DirectFileWriter::Close() {
+  if (fd_ < 0) {
+    return;
+  }
+  Flush();
+  if (ftruncate(fd_, size()) != 0) {
+    ThrowErrno("ftruncate " + path_.string());
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+void DirectFileWriter::WriteBuffer(size_t bytes) {
+  for (size_t written = 0; written < bytes;) {
+    ssize_t n = pwrite(fd_, buffer_.get() + written, bytes - written,
+                       file_offset_ + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowErrno("pwrite " + path_.string());
+    }
+    written += n;
+  }
+}
+
+}  // namespace rd::bitcask
@@ -0,0 +1,71 @@
+// Append-only file written with direct I/O, bypassing the page cache.
+//
+// Cask files are written once and mostly never read back (merges aside), so
+// caching them as they're written just evicts values that `Get` does read.
+// `O_DIRECT` writes go straight to the device instead, but must be aligned:
+// whole blocks, from aligned memory, at aligned offsets. Appends collect in an
+// aligned buffer, and a flush writes it out padded with zeros to a whole
+// block. The partial block stays buffered and is written again (with more
+// appended to it) by the next flush, until the file is closed and the padding
+// truncated away.
+
+#ifndef RD_BITCASK_DIRECT_FILE_H_
+#define RD_BITCASK_DIRECT_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+#include "file_writer.h"
+
+namespace rd::bitcask {
+
+class DirectFileWriter : public FileWriter {
+ public:
+  // Alignment of buffers, offsets and lengths: the page size, which covers
+  // any logical block size in practice.
+  static constexpr size_t kAlignment = 4096;
+
+  // Creates (truncating) the file at `path`. Filesystems without direct I/O
+  // (e.g. tmpfs) get the same aligned writes through the page cache. Throws
+  // `std::system_error` if the file can't be created.
+  explicit DirectFileWriter(const std::filesystem::path& path,
+                            size_t buffer_size = 1024 * 1024);
+  ~DirectFileWriter() override;
+
+  DirectFileWriter(const DirectFileWriter&) = delete;
+  DirectFileWriter& operator=(const DirectFileWriter&) = delete;
+
+  void Append(std::string_view data, std::string_view more = {}) override;
+
+  // Until `Close`, the file may end with up to a block of zeros.
+  void Flush() override;
+
+  void Close() override;
+  uint64_t size() const override { return file_offset_ + buffered_; }
+  int fd() const override { return fd_; }
+
+ private:
+  // Writes the first `bytes` (a multiple of `kAlignment`) of the buffer at
+  // `file_offset_`.
+  void WriteBuffer(size_t bytes);
+
+  struct Free {
+    void operator()(char* buffer) const { std::free(buffer); }
+  };
+
+  std::filesystem::path path_;
+  int fd_;
+  std::unique_ptr<char, Free> buffer_;
+  const size_t capacity_;
+  size_t buffered_ = 0;
+  // Offset of the start of the buffer in the file; always aligned.
+  uint64_t file_offset_ = 0;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_DIRECT_FILE_H_
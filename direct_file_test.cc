@@ -0,0 +1,48 @@
+#include "direct_file.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+std::string ReadFile(const fs::path& path) {
+  std::ifstream input(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(input), {});
+}
+
+TEST(DirectFileWriterTest, AppendsAcrossFlushes) {
+  fs::path path = fs::path(testing::TempDir()) / "direct_file_test";
+  std::string expected;
+  {
+    // A buffer of two blocks, so appends both straddle and fill it.
+    DirectFileWriter writer(path, 2 * DirectFileWriter::kAlignment);
+    for (int i = 0; i < 1000; ++i) {
+      std::string data = std::to_string(i) + std::string(i % 37, 'x');
+      writer.Append(data);
+      expected += data;
+      if (i % 10 == 0) {
+        writer.Flush();
+        // Flushed data is readable straight away, followed by padding.
+        std::string contents = ReadFile(path);
+        ASSERT_GE(contents.size(), expected.size());
+        EXPECT_EQ(contents.substr(0, expected.size()), expected);
+        EXPECT_EQ(contents.size() % DirectFileWriter::kAlignment, 0);
+      }
+    }
+    EXPECT_EQ(writer.size(), expected.size());
+  }
+
+  // Closing trims the padding.
+  EXPECT_EQ(ReadFile(path), expected);
+  fs::remove(path);
+}
+
+}  // namespace
+}  // namespace rd::bitcask
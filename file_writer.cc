@@ -0,0 +1,106 @@
+#include "file_writer.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+namespace rd::bitcask {
+namespace {
+
+[[noreturn]] void ThrowErrno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+}  // namespace
+
+BufferedFileWriter::BufferedFileWriter(const std::filesystem::path& path,
+                                       size_t buffer_size)
+    : path_(path), capacity_(buffer_size) {
+  fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    ThrowErrno("open " + path_.string());
+  }
+  buffer_.reserve(capacity_);
+}
+
+BufferedFileWriter::~BufferedFileWriter() {
+  try {
+    Close();
+  } catch (const std::system_error&) {
+    // Nowhere to report it; whatever was flushed before is intact.
+  }
+}
+
+void BufferedFileWriter::Append(std::string_view data,
+                                std::string_view more) {
+  if (buffer_.size() + data.size() + more.size() <= capacity_) {
+    buffer_.append(data);
+    buffer_.append(more);
+  } else {
+    // 💡: rather than copying a large value into the buffer only to write it
+    // straight back out, hand everything to the kernel at once.
+    WriteBufferAnd(data, more);
+  }
+  // Only counted once taken, so a write that throws leaves `size()` alone.
+  size_ += data.size() + more.size();
+}
+
+void BufferedFileWriter::Flush() {
+  if (!buffer_.empty()) {
+    WriteBufferAnd({}, {});
+  }
+}
+
+void BufferedFileWriter::Close() {
+  if (fd_ < 0) {
+    return;
+  }
+  Flush();
+  if (ftruncate(fd_, size_) != 0) {
+    ThrowErrno("ftruncate " + path_.string());
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+void BufferedFileWriter::WriteBufferAnd(std::string_view data,
+                                        std::string_view more) {
+  iovec parts[3] = {
+      {.iov_base = buffer_.data(), .iov_len = buffer_.size()},
+      {.iov_base = const_cast<char*>(data.data()), .iov_len = data.size()},
+      {.iov_base = const_cast<char*>(more.data()), .iov_len = more.size()},
+  };
+  iovec* part = parts;
+  int num_parts = 3;
+  // Writing at an explicit offset, rather than the descriptor's, means a
+  // failed write is simply overwritten by the next.
+  auto offset = static_cast<off_t>(size_ - buffer_.size());
+  while (num_parts > 0) {
+    ssize_t n = pwritev(fd_, part, num_parts, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowErrno("pwritev " + path_.string());
+    }
+    offset += n;
+    // Short writes are rare, but pick up where they left off.
+    for (auto written = static_cast<size_t>(n); num_parts > 0;) {
+      if (written < part->iov_len) {
+        part->iov_base = static_cast<char*>(part->iov_base) + written;
+        part->iov_len -= written;
+        break;
+      }
+      written -= part->iov_len;
+      ++part;
+      --num_parts;
+    }
+  }
+  buffer_.clear();
+}
+
+}  // namespace rd::bitcask
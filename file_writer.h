@@ -0,0 +1,81 @@
+// Append-only writers for cask files.
+//
+// The active file used to be a `std::ofstream`, written a field at a time
+// with `operator<<`: every field paid for a sentry object, a virtual call
+// into the stream buffer and a locale check. These writers work on a raw
+// descriptor instead. Records are copied into one contiguous buffer and
+// each flush is a single `pwritev`, which also takes values too large to be
+// worth copying.
+
+#ifndef RD_BITCASK_FILE_WRITER_H_
+#define RD_BITCASK_FILE_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace rd::bitcask {
+
+// Interface for the writers of the active file.
+class FileWriter {
+ public:
+  virtual ~FileWriter() = default;
+
+  // Appends `data` followed by `more`, as one unit: if this throws, neither
+  // was appended and the writer is as it was before the call.
+  virtual void Append(std::string_view data, std::string_view more = {}) = 0;
+
+  // Writes out everything appended so far.
+  virtual void Flush() = 0;
+
+  // Flushes, then trims the file to `size()`. This frees any space
+  // preallocated past the end of the file. Nothing may be appended
+  // afterwards. The destructor calls this too.
+  virtual void Close() = 0;
+
+  // Bytes appended so far (the file's size once flushed).
+  virtual uint64_t size() const = 0;
+
+  // Descriptor of the file, for `fallocate` and the like. Only valid until
+  // `Close`.
+  virtual int fd() const = 0;
+};
+
+// Writes through the page cache, buffering appends in memory until the next
+// flush (or until the buffer fills).
+class BufferedFileWriter : public FileWriter {
+ public:
+  // Creates (truncating) the file at `path`. Throws `std::system_error` if
+  // the file can't be created.
+  explicit BufferedFileWriter(const std::filesystem::path& path,
+                              size_t buffer_size = 64 * 1024);
+  ~BufferedFileWriter() override;
+
+  BufferedFileWriter(const BufferedFileWriter&) = delete;
+  BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+  void Append(std::string_view data, std::string_view more = {}) override;
+  void Flush() override;
+  void Close() override;
+  uint64_t size() const override { return size_; }
+  int fd() const override { return fd_; }
+
+ private:
+  // Writes the buffer followed by `data` and `more` with a single `pwritev`
+  // (looping on short writes), then empties the buffer. Throws without
+  // changing the buffer; whatever did reach the file is past `size()`, so
+  // the next write overwrites it.
+  void WriteBufferAnd(std::string_view data, std::string_view more);
+
+  std::filesystem::path path_;
+  int fd_;
+  std::string buffer_;
+  const size_t capacity_;
+  uint64_t size_ = 0;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_FILE_WRITER_H_
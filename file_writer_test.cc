@@ -0,0 +1,59 @@
+#include "file_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+std::string ReadFile(const fs::path& path) {
+  std::ifstream input(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(input), {});
+}
+
+TEST(BufferedFileWriterTest, AppendsAcrossFlushes) {
+  fs::path path = fs::path(testing::TempDir()) / "file_writer_test";
+  std::string expected;
+  {
+    BufferedFileWriter writer(path, 64);
+    writer.Append("small");
+    expected += "small";
+    EXPECT_EQ(ReadFile(path), "");
+    writer.Flush();
+    EXPECT_EQ(ReadFile(path), expected);
+
+    // Larger than the buffer: written along with whatever is buffered.
+    writer.Append("buffered");
+    writer.Append(std::string(1000, 'x'));
+    expected += "buffered" + std::string(1000, 'x');
+    EXPECT_EQ(ReadFile(path), expected);
+    writer.Append("tail");
+    expected += "tail";
+    EXPECT_EQ(writer.size(), expected.size());
+  }
+
+  // Closing flushes.
+  EXPECT_EQ(ReadFile(path), expected);
+  fs::remove(path);
+}
+
+TEST(BufferedFileWriterTest, CountsOnlyAppendsThatSucceed) {
+  // Every write to /dev/full fails with `ENOSPC`.
+  if (!fs::exists("/dev/full")) {
+    GTEST_SKIP() << "No /dev/full";
+  }
+  BufferedFileWriter writer("/dev/full", 64);
+  writer.Append("small");
+  EXPECT_THROW(writer.Append(std::string(1000, 'x')), std::system_error);
+  EXPECT_EQ(writer.size(), 5);
+}
+
+}  // namespace
+}  // namespace rd::bitcask
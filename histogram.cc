@@ -0,0 +1,163 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace rd::bitcask {
+
+size_t Histogram::BucketFor(uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - kSubBucketBits;
+  size_t sub_bucket = (value >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub_bucket;
+}
+
+uint64_t Histogram::BucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  uint64_t sub_bucket = bucket % kSubBuckets;
+  uint64_t lower = (kSubBuckets + sub_bucket) << shift;
+  return lower + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::Record(uint64_t value) {
+  ++buckets_[BucketFor(value)];
+  ++count_;
+  sum_ += value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+uint64_t Histogram::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * count_)));
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::clamp(BucketUpperBound(i), min(), max_);
+    }
+  }
+  return max_;
+}
+
+std::string Histogram::ToString() const {
+  std::stringstream ss;
+  ss << "count=" << count_ << " mean=" << mean() << " min=" << min()
+     << " p50=" << Percentile(50) << " p90=" << Percentile(90)
+     << " p99=" << Percentile(99) << " p99.9=" << Percentile(99.9)
+     << " max=" << max_;
+  return ss.str();
+}
+
+namespace {
+
+// Bumps a single-writer counter without a locked read-modify-write.
+void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+std::atomic<uint64_t> next_histogram_id{1};
+
+}  // namespace
+
+ConcurrentHistogram::ConcurrentHistogram()
+    : id_(next_histogram_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+ConcurrentHistogram::Shard& ConcurrentHistogram::LocalShard() {
+  // Recently used shards of this thread, direct-mapped by histogram ID. A
+  // fixed size keeps threads that outlive many histograms (e.g. opening one
+  // Bitcask after another) from piling up entries; two histograms sharing a
+  // slot just take turns going through `shards_`.
+  constexpr size_t kCacheSize = 64;
+  struct CachedShard {
+    uint64_t id = 0;
+    Shard* shard = nullptr;
+  };
+  thread_local std::array<CachedShard, kCacheSize> cache;
+  CachedShard& cached = cache[id_ % kCacheSize];
+  if (cached.id == id_) {
+    return *cached.shard;
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  std::unique_ptr<Shard>& shard = shards_[std::this_thread::get_id()];
+  if (shard == nullptr) {
+    shard = std::make_unique<Shard>();
+  }
+  cached = {.id = id_, .shard = shard.get()};
+  return *shard;
+}
+
+void ConcurrentHistogram::Record(uint64_t value) {
+  Shard& shard = LocalShard();
+  Add(shard.buckets[Histogram::BucketFor(value)], 1);
+  Add(shard.count, 1);
+  Add(shard.sum, value);
+  if (value < shard.min.load(std::memory_order_relaxed)) {
+    shard.min.store(value, std::memory_order_relaxed);
+  }
+  if (value > shard.max.load(std::memory_order_relaxed)) {
+    shard.max.store(value, std::memory_order_relaxed);
+  }
+}
+
+void ConcurrentHistogram::Merge(const Histogram& histogram) {
+  if (histogram.count() == 0) {
+    return;
+  }
+  Shard& shard = LocalShard();
+  for (size_t i = 0; i < Histogram::kNumBuckets; ++i) {
+    Add(shard.buckets[i], histogram.buckets_[i]);
+  }
+  Add(shard.count, histogram.count_);
+  Add(shard.sum, histogram.sum_);
+  if (histogram.min_ < shard.min.load(std::memory_order_relaxed)) {
+    shard.min.store(histogram.min_, std::memory_order_relaxed);
+  }
+  if (histogram.max_ > shard.max.load(std::memory_order_relaxed)) {
+    shard.max.store(histogram.max_, std::memory_order_relaxed);
+  }
+}
+
+Histogram ConcurrentHistogram::Snapshot() const {
+  Histogram merged;
+  std::lock_guard<std::mutex> lock(mu_);
+  for (const auto& [thread, shard] : shards_) {
+    for (size_t i = 0; i < Histogram::kNumBuckets; ++i) {
+      merged.buckets_[i] += shard->buckets[i].load(std::memory_order_relaxed);
+    }
+    merged.count_ += shard->count.load(std::memory_order_relaxed);
+    merged.sum_ += shard->sum.load(std::memory_order_relaxed);
+    merged.min_ =
+        std::min(merged.min_, shard->min.load(std::memory_order_relaxed));
+    merged.max_ =
+        std::max(merged.max_, shard->max.load(std::memory_order_relaxed));
+  }
+  return merged;
+}
+
+}  // namespace rd::bitcask
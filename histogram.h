@@ -0,0 +1,129 @@
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values below 2^kSubBucketBits are counted exactly; above that, each power of
+// two is split into 2^kSubBucketBits equal sub-buckets, so any recorded value
+// is known to within ~3% regardless of magnitude. The whole uint64_t range fits
+// in a fixed ~15 KiB, and recording is a couple of bit operations.
+
+#ifndef RD_BITCASK_HISTOGRAM_H_
+#define RD_BITCASK_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace rd::bitcask {
+
+class Histogram {
+ public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+  static constexpr size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  void Record(uint64_t value);
+
+  // Adds every value recorded in `other` to this histogram.
+  void Merge(const Histogram& other);
+
+  void Clear() { *this = Histogram(); }
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ == 0 ? 0 : min_; }
+  uint64_t max() const { return max_; }
+  uint64_t sum() const { return sum_; }
+  double mean() const {
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+  // Smallest value that `percentile` (in [0, 100]) percent of the recorded
+  // values are less than or equal to, to within the bucket precision.
+  uint64_t Percentile(double percentile) const;
+
+  // E.g., "count=10 mean=4.2 min=1 p50=4 p90=8 p99=9 p99.9=9 max=9".
+  std::string ToString() const;
+
+  // Maps values to bucket indices and back (exposed for testing).
+  static size_t BucketFor(uint64_t value);
+  static uint64_t BucketUpperBound(size_t bucket);
+
+ private:
+  friend class ConcurrentHistogram;
+
+  std::array<uint64_t, kNumBuckets> buckets_{};
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+};
+
+// `Histogram` that any number of threads can record into at once.
+//
+// Each thread records into its own shard, so recording never contends on a
+// cache line or needs a locked instruction - a shard only ever has a single
+// writer, which publishes with plain relaxed stores. Reading merges the shards
+// into a regular `Histogram`. Shards outlive the threads that filled them.
+class ConcurrentHistogram {
+ public:
+  ConcurrentHistogram();
+
+  ConcurrentHistogram(const ConcurrentHistogram&) = delete;
+  ConcurrentHistogram& operator=(const ConcurrentHistogram&) = delete;
+
+  void Record(uint64_t value);
+
+  // Adds everything in `histogram` (e.g., values collected before this
+  // histogram existed).
+  void Merge(const Histogram& histogram);
+
+  // Merges every shard into a single histogram.
+  Histogram Snapshot() const;
+
+ private:
+  struct Shard {
+    std::array<std::atomic<uint64_t>, Histogram::kNumBuckets> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> min{UINT64_MAX};
+    std::atomic<uint64_t> max{0};
+  };
+
+  // Returns the calling thread's shard, creating it on first use.
+  Shard& LocalShard();
+
+  // Distinguishes this histogram in the per-thread shard caches, which can't
+  // use the address as it may be reused once this histogram is destroyed.
+  // IDs are never reused, so cache entries for destroyed histograms are
+  // simply never matched again.
+  const uint64_t id_;
+
+  mutable std::mutex mu_;
+  // Keyed by thread. A thread's ID may be reused once it has exited, and its
+  // successor picks up the shard, which keeps a single writer.
+  std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards_;
+};
+
+// Records the time between construction and destruction, in nanoseconds.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(ConcurrentHistogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    histogram_.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start_)
+                          .count());
+  }
+
+ private:
+  ConcurrentHistogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_HISTOGRAM_H_
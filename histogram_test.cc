@@ -0,0 +1,117 @@
+#include "histogram.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+TEST(HistogramTest, EmptyHistogram) {
+  Histogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.min(), 0);
+  EXPECT_EQ(histogram.max(), 0);
+  EXPECT_EQ(histogram.Percentile(50), 0);
+}
+
+TEST(HistogramTest, SmallValuesAreExact) {
+  Histogram histogram;
+  for (uint64_t i = 1; i <= 20; ++i) {
+    histogram.Record(i);
+  }
+  EXPECT_EQ(histogram.count(), 20);
+  EXPECT_EQ(histogram.min(), 1);
+  EXPECT_EQ(histogram.max(), 20);
+  EXPECT_DOUBLE_EQ(histogram.mean(), 10.5);
+  EXPECT_EQ(histogram.Percentile(50), 10);
+  EXPECT_EQ(histogram.Percentile(100), 20);
+}
+
+TEST(HistogramTest, LargeValuesAreApproximate) {
+  Histogram histogram;
+  for (uint64_t i = 1; i <= 100'000; ++i) {
+    histogram.Record(i * 1000);
+  }
+  // Within the ~3% bucket precision.
+  EXPECT_NEAR(histogram.Percentile(50), 50'000'000, 50'000'000 * 0.04);
+  EXPECT_NEAR(histogram.Percentile(99), 99'000'000, 99'000'000 * 0.04);
+  EXPECT_EQ(histogram.Percentile(100), 100'000'000);
+}
+
+TEST(HistogramTest, BucketsCoverTheirValues) {
+  for (uint64_t value : {uint64_t{0}, uint64_t{31}, uint64_t{32},
+                         uint64_t{12345}, UINT64_MAX}) {
+    size_t bucket = Histogram::BucketFor(value);
+    ASSERT_LT(bucket, Histogram::kNumBuckets);
+    EXPECT_GE(Histogram::BucketUpperBound(bucket), value);
+    if (bucket > 0) {
+      EXPECT_LT(Histogram::BucketUpperBound(bucket - 1), value);
+    }
+  }
+}
+
+TEST(HistogramTest, Merges) {
+  Histogram a;
+  Histogram b;
+  a.Record(1);
+  b.Record(100);
+  b.Record(3);
+  a.Merge(b);
+  EXPECT_EQ(a.count(), 3);
+  EXPECT_EQ(a.min(), 1);
+  EXPECT_EQ(a.max(), 100);
+}
+
+TEST(ConcurrentHistogramTest, MergesThreads) {
+  ConcurrentHistogram histogram;
+  std::vector<std::thread> threads;
+  for (uint64_t t = 1; t <= 4; ++t) {
+    threads.emplace_back([&histogram, t] {
+      for (int i = 0; i < 1000; ++i) {
+        histogram.Record(t);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  histogram.Record(100);
+
+  Histogram snapshot = histogram.Snapshot();
+  EXPECT_EQ(snapshot.count(), 4001);
+  EXPECT_EQ(snapshot.min(), 1);
+  EXPECT_EQ(snapshot.max(), 100);
+  EXPECT_EQ(snapshot.Percentile(50), 3);
+}
+
+TEST(ConcurrentHistogramTest, OutlivesManyHistogramsPerThread) {
+  // Enough to wrap around the per-thread shard cache many times over, so
+  // live histograms share cache slots with each other and with dead ones.
+  std::vector<std::unique_ptr<ConcurrentHistogram>> histograms;
+  for (int i = 0; i < 1000; ++i) {
+    histograms.push_back(std::make_unique<ConcurrentHistogram>());
+    histograms.back()->Record(i);
+    if (i % 2 == 0) {
+      histograms.back().reset();
+    }
+  }
+  for (int round = 0; round < 3; ++round) {
+    for (const auto& histogram : histograms) {
+      if (histogram != nullptr) {
+        histogram->Record(1);
+      }
+    }
+  }
+  for (int i = 1; i < 1000; i += 2) {
+    Histogram snapshot = histograms[i]->Snapshot();
+    EXPECT_EQ(snapshot.count(), 4);
+    EXPECT_EQ(snapshot.max(), i);
+  }
+}
+
+}  // namespace
+}  // namespace rd::bitcask
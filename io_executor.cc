@@ -0,0 +1,51 @@
+#include "io_executor.h"
+
+#include <functional>
+#include <mutex>
+#include <utility>
+
+namespace rd::bitcask {
+
+IoExecutor::IoExecutor(size_t num_threads) {
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&IoExecutor::Run, this);
+  }
+}
+
+IoExecutor::~IoExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  work_available_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void IoExecutor::Submit(std::function<void()> work) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    work_.push_back(std::move(work));
+  }
+  work_available_.notify_one();
+}
+
+void IoExecutor::Run() {
+  for (;;) {
+    std::function<void()> work;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      work_available_.wait(lock, [&] { return stop_ || !work_.empty(); });
+      if (work_.empty()) {
+        return;
+      }
+      work = std::move(work_.front());
+      work_.pop_front();
+    }
+    work();
+  }
+}
+
+}  // namespace rd::bitcask
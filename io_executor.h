@@ -0,0 +1,107 @@
+// Thread pool for blocking file I/O, and (in C++20 builds) an awaitable that
+// runs work on it.
+//
+// Coroutines can't block on a file read without blocking the thread they're
+// running on, along with every other coroutine it would run. Instead they
+// `co_await` an `AsyncResult`, which suspends the coroutine, runs the blocking
+// call on an `IoExecutor` thread, and resumes the coroutine there with the
+// result.
+
+#ifndef RD_BITCASK_IO_EXECUTOR_H_
+#define RD_BITCASK_IO_EXECUTOR_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define RD_BITCASK_HAS_COROUTINES 1
+#endif
+
+namespace rd::bitcask {
+
+class IoExecutor {
+ public:
+  explicit IoExecutor(size_t num_threads);
+  // Runs everything already submitted, then joins the threads.
+  ~IoExecutor();
+
+  IoExecutor(const IoExecutor&) = delete;
+  IoExecutor& operator=(const IoExecutor&) = delete;
+
+  // Queues `work` to run on one of the threads. `work` mustn't throw.
+  void Submit(std::function<void()> work);
+
+ private:
+  void Run();
+
+  std::mutex mu_;
+  std::condition_variable work_available_;
+  std::deque<std::function<void()>> work_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+#ifdef RD_BITCASK_HAS_COROUTINES
+
+// Awaitable result of `op`, which is run on `executor` once awaited (and not
+// before). The awaiting coroutine resumes on the executor thread; anything
+// `op` throws is rethrown from the `co_await`.
+template <typename T>
+class AsyncResult {
+ public:
+  AsyncResult(IoExecutor& executor, std::function<T()> op)
+      : executor_(&executor), op_(std::move(op)) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> caller) {
+    // 💡: the awaitable lives in the suspended coroutine's frame, so `this`
+    // stays valid until `caller` is resumed.
+    executor_->Submit([this, caller] {
+      try {
+        if constexpr (std::is_void_v<T>) {
+          op_();
+        } else {
+          result_.emplace(op_());
+        }
+      } catch (...) {
+        error_ = std::current_exception();
+      }
+      caller.resume();
+    });
+  }
+
+  T await_resume() {
+    if (error_ != nullptr) {
+      std::rethrow_exception(error_);
+    }
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*result_);
+    }
+  }
+
+ private:
+  // Placeholder for `result_` when there's no result to hold.
+  struct Empty {};
+
+  IoExecutor* executor_;
+  std::function<T()> op_;
+  std::conditional_t<std::is_void_v<T>, Empty, std::optional<T>> result_;
+  std::exception_ptr error_;
+};
+
+#endif  // RD_BITCASK_HAS_COROUTINES
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_IO_EXECUTOR_H_
@@ -0,0 +1,322 @@
+// Load generator for Bitcask, in the spirit of LevelDB's db_bench.
+//
+// Runs a mix of reads, writes and deletes from several threads for a fixed
+// duration, then reports throughput and per-operation latency percentiles.
+//
+// Command:
+//   $ ./build/main --threads=8 --read_ratio=0.9 --distribution=zipfian
+//       --value_size=100 --value_size_max=4000 --duration=30
+//
+// Flags:
+//   --db               Directory of the cask (default /tmp/bitcask_load).
+//   --fresh            Remove `--db` before starting (default true).
+//   --threads          Number of client threads (default 4).
+//   --duration         Seconds to run for (default 10).
+//   --num_keys         Keys written before the run starts (default 100000).
+//   --read_ratio       Fraction of operations that are Gets (default 0.5).
+//   --delete_ratio     Fraction of operations that are Deletes (default 0).
+//                      Everything else is a Put.
+//   --distribution     uniform, zipfian or latest (default uniform). With
+//                      `latest`, Puts insert new keys rather than overwrite.
+//   --zipf_theta       Skew of zipfian/latest (default 0.99).
+//   --value_size       Value size in bytes (default 100).
+//   --value_size_max   If set, value sizes are uniform in
+//                      [value_size, value_size_max].
+//   --compression      none or lz (default none).
+//   --writer_thread    Use `Options::writer_thread` (default false).
+//   --report_interval  Seconds between progress lines, 0 for none (default 1).
+//   --trace            If set, write a Chrome trace of every operation to this
+//                      file (load it in chrome://tracing or Perfetto). Keep
+//                      runs short - every span is recorded.
+//
+// NOTE: `Bitcask` isn't thread-safe without `--writer_thread`, so every
+// operation is then serialized on a mutex. Latencies include time spent
+// waiting for it, much as they would in a server that shares one instance
+// between request threads.
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitcask.h"
+#include "histogram.h"
+#include "trace.h"
+#include "workload.h"
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  std::string db;
+  bool fresh;
+  int threads;
+  double duration_s;
+  uint64_t num_keys;
+  double read_ratio;
+  double delete_ratio;
+  workload::Distribution distribution;
+  std::string distribution_name;
+  double zipf_theta;
+  size_t value_size;
+  size_t value_size_max;
+  CodecId compression;
+  bool writer_thread;
+  double report_interval_s;
+  std::string trace;
+};
+
+Config ParseConfig(int argc, char** argv) {
+  workload::Flags flags(argc, argv);
+  Config config;
+  config.db = flags.GetString("db", "/tmp/bitcask_load");
+  config.fresh = flags.GetBool("fresh", true);
+  config.threads = flags.GetInt("threads", 4);
+  config.duration_s = flags.GetDouble("duration", 10);
+  config.num_keys = flags.GetInt("num_keys", 100'000);
+  config.read_ratio = flags.GetDouble("read_ratio", 0.5);
+  config.delete_ratio = flags.GetDouble("delete_ratio", 0);
+  config.distribution_name = flags.GetString("distribution", "uniform");
+  config.zipf_theta = flags.GetDouble("zipf_theta", 0.99);
+  config.value_size = flags.GetInt("value_size", 100);
+  config.value_size_max = flags.GetInt("value_size_max", config.value_size);
+  config.writer_thread = flags.GetBool("writer_thread", false);
+  config.report_interval_s = flags.GetDouble("report_interval", 1);
+  config.trace = flags.GetString("trace", "");
+  std::string compression = flags.GetString("compression", "none");
+  flags.CheckAllUsed();
+
+  auto distribution = workload::ParseDistribution(config.distribution_name);
+  if (!distribution) {
+    std::cerr << "Unknown --distribution: " << config.distribution_name << "\n";
+    std::exit(1);
+  }
+  config.distribution = *distribution;
+
+  if (compression == "none") {
+    config.compression = CodecId::kNone;
+  } else if (compression == "lz") {
+    config.compression = CodecId::kLz;
+  } else {
+    std::cerr << "Unknown --compression: " << compression << "\n";
+    std::exit(1);
+  }
+
+  if (config.threads < 1 || config.num_keys < 1 ||
+      config.value_size_max < config.value_size ||
+      config.read_ratio + config.delete_ratio > 1) {
+    std::cerr << "Invalid flag combination\n";
+    std::exit(1);
+  }
+  return config;
+}
+
+// Results of a single client thread.
+struct ThreadStats {
+  Histogram reads;
+  Histogram writes;
+  Histogram deletes;
+  uint64_t misses = 0;
+  uint64_t bytes = 0;
+};
+
+class LoadGenerator {
+ public:
+  explicit LoadGenerator(const Config& config)
+      : config_(config),
+        bitcask_(Bitcask::Open(
+            config.db,
+            {.compression = config.compression,
+             .trace_sink = config.trace.empty()
+                               ? nullptr
+                               : std::make_shared<ChromeTraceWriter>(
+                                     config.trace),
+             .writer_thread = config.writer_thread})),
+        key_count_(config.num_keys) {}
+
+  void Preload() {
+    std::mt19937_64 rng(0);
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < config_.num_keys; ++i) {
+      bitcask_.Put(workload::KeyName(i), NextValue(rng));
+    }
+    double elapsed = SecondsSince(start);
+    std::cout << "preload: " << config_.num_keys << " keys in " << std::fixed
+              << std::setprecision(2) << elapsed << "s ("
+              << std::setprecision(0) << config_.num_keys / elapsed
+              << " ops/s)\n";
+  }
+
+  void Run() {
+    std::vector<ThreadStats> stats(config_.threads);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(config_.duration_s));
+    for (int i = 0; i < config_.threads; ++i) {
+      threads.emplace_back([&, i] { Client(i, deadline, stats[i]); });
+    }
+    Report(start, deadline);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double elapsed = SecondsSince(start);
+
+    ThreadStats total;
+    for (const auto& s : stats) {
+      total.reads.Merge(s.reads);
+      total.writes.Merge(s.writes);
+      total.deletes.Merge(s.deletes);
+      total.misses += s.misses;
+      total.bytes += s.bytes;
+    }
+    uint64_t ops =
+        total.reads.count() + total.writes.count() + total.deletes.count();
+
+    std::cout << "run: " << ops << " ops in " << std::fixed
+              << std::setprecision(2) << elapsed << "s: "
+              << std::setprecision(0) << ops / elapsed << " ops/s, "
+              << std::setprecision(1) << total.bytes / elapsed / 1e6
+              << " MB/s\n";
+    workload::PrintLatencies(std::cout, "read", total.reads);
+    workload::PrintLatencies(std::cout, "write", total.writes);
+    workload::PrintLatencies(std::cout, "delete", total.deletes);
+    std::cout << "read misses: " << total.misses << "\n";
+  }
+
+ private:
+  static double SecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  std::string NextValue(std::mt19937_64& rng) {
+    size_t size = std::uniform_int_distribution<size_t>(
+        config_.value_size, config_.value_size_max)(rng);
+    return workload::RandomValue(size, rng);
+  }
+
+  void Client(int id, Clock::time_point deadline, ThreadStats& stats) {
+    std::mt19937_64 rng(id + 1);
+    std::uniform_real_distribution<double> coin(0, 1);
+    workload::KeyChooser chooser(config_.distribution, config_.num_keys,
+                                 config_.zipf_theta);
+
+    while (Clock::now() < deadline) {
+      double op = coin(rng);
+      uint64_t key_count = key_count_.load(std::memory_order_relaxed);
+
+      if (op < config_.read_ratio) {
+        std::string key = workload::KeyName(chooser.Next(key_count, rng));
+        auto start = Clock::now();
+        try {
+          auto lock = Lock();
+          stats.bytes += key.size() + bitcask_.Get(key).size();
+        } catch (const MissingKeyException&) {
+          ++stats.misses;
+        }
+        stats.reads.Record(NanosSince(start));
+      } else if (op < config_.read_ratio + config_.delete_ratio) {
+        std::string key = workload::KeyName(chooser.Next(key_count, rng));
+        auto start = Clock::now();
+        {
+          auto lock = Lock();
+          bitcask_.Delete(key);
+        }
+        stats.deletes.Record(NanosSince(start));
+      } else {
+        // `latest` grows the key space; the others overwrite.
+        uint64_t key_number =
+            config_.distribution == workload::Distribution::kLatest
+                ? key_count_.fetch_add(1, std::memory_order_relaxed)
+                : chooser.Next(key_count, rng);
+        std::string key = workload::KeyName(key_number);
+        std::string value = NextValue(rng);
+        stats.bytes += key.size() + value.size();
+        auto start = Clock::now();
+        {
+          auto lock = Lock();
+          bitcask_.Put(key, std::move(value));
+        }
+        stats.writes.Record(NanosSince(start));
+      }
+      ops_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Locks `mu_`, unless the Bitcask does its own locking.
+  std::unique_lock<std::mutex> Lock() {
+    if (config_.writer_thread) {
+      return std::unique_lock<std::mutex>(mu_, std::defer_lock);
+    }
+    return std::unique_lock<std::mutex>(mu_);
+  }
+
+  static uint64_t NanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+        .count();
+  }
+
+  // Prints the throughput of each interval until `deadline`.
+  void Report(Clock::time_point start, Clock::time_point deadline) {
+    if (config_.report_interval_s <= 0) {
+      return;
+    }
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(config_.report_interval_s));
+    uint64_t last_ops = 0;
+    for (auto next = start + interval; next < deadline; next += interval) {
+      std::this_thread::sleep_until(next);
+      uint64_t ops = ops_.load(std::memory_order_relaxed);
+      std::cout << std::fixed << std::setprecision(1) << "... "
+                << SecondsSince(start) << "s: " << std::setprecision(0)
+                << (ops - last_ops) / config_.report_interval_s << " ops/s\n"
+                << std::flush;
+      last_ops = ops;
+    }
+  }
+
+  const Config& config_;
+  std::mutex mu_;
+  Bitcask bitcask_;
+  // Number of keys that have been written (and so may be read).
+  std::atomic<uint64_t> key_count_;
+  std::atomic<uint64_t> ops_ = 0;
+};
+
+}  // namespace
+}  // namespace rd::bitcask
+
+int main(int argc, char** argv) {
+  using namespace rd::bitcask;
+
+  Config config = ParseConfig(argc, argv);
+  if (config.fresh) {
+    std::filesystem::remove_all(config.db);
+  }
+
+  std::cout << "bitcask load: threads=" << config.threads
+            << " read_ratio=" << config.read_ratio
+            << " delete_ratio=" << config.delete_ratio
+            << " distribution=" << config.distribution_name
+            << " value_size=" << config.value_size << ".."
+            << config.value_size_max << " duration=" << config.duration_s
+            << "s\n";
+
+  LoadGenerator generator(config);
+  generator.Preload();
+  generator.Run();
+  return 0;
+}
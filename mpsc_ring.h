@@ -0,0 +1,94 @@
+// Bounded lock-free queue for many producers and a single consumer.
+//
+// Dmitry Vyukov's bounded queue: each cell carries a sequence number saying
+// whose turn it is. A producer claims a position with one CAS on the tail and
+// publishes by bumping its cell's sequence; the consumer owns the head outright,
+// so popping needs no atomic read-modify-write at all. Neither side ever
+// blocks - a full or empty ring just returns false.
+
+#ifndef RD_BITCASK_MPSC_RING_H_
+#define RD_BITCASK_MPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace rd::bitcask {
+
+template <typename T>
+class MpscRing {
+ public:
+  // `capacity` must be a power of two.
+  explicit MpscRing(size_t capacity)
+      : cells_(std::make_unique<Cell[]>(capacity)), mask_(capacity - 1) {
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing&) = delete;
+  MpscRing& operator=(const MpscRing&) = delete;
+
+  // Appends `value` unless the ring is full. Safe to call from any thread.
+  bool TryPush(T value) {
+    size_t position = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[position & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<intptr_t>(sequence - position);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (lag < 0) {
+        // The consumer hasn't freed this cell since the last lap.
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Removes the oldest value into `value` unless the ring is empty. Only
+  // the consumer thread may call this (and `Empty`).
+  bool TryPop(T* value) {
+    Cell& cell = cells_[head_ & mask_];
+    if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    *value = std::move(cell.value);
+    // Frees the cell for the producer one lap ahead.
+    cell.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  bool Empty() const {
+    return cells_[head_ & mask_].sequence.load(std::memory_order_acquire) !=
+           head_ + 1;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  const std::unique_ptr<Cell[]> cells_;
+  const size_t mask_;
+  // 💡: producers hammer `tail_` while the consumer walks `head_`; keeping
+  // them on separate cache lines stops each side invalidating the other's.
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) size_t head_ = 0;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_MPSC_RING_H_
@@ -0,0 +1,66 @@
+#include "mpsc_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+TEST(MpscRingTest, PopsInOrder) {
+  MpscRing<int> ring(4);
+  int value;
+  EXPECT_TRUE(ring.Empty());
+  EXPECT_FALSE(ring.TryPop(&value));
+
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(ring.TryPush(i));
+  }
+  EXPECT_FALSE(ring.TryPush(4));
+  EXPECT_FALSE(ring.Empty());
+
+  // Wraps around once cells are freed.
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(value, i);
+    EXPECT_TRUE(ring.TryPush(i + 4));
+  }
+}
+
+TEST(MpscRingTest, DeliversEveryValueFromManyProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kValuesEach = 10000;
+  MpscRing<int> ring(64);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&, p] {
+      for (int i = 0; i < kValuesEach; ++i) {
+        while (!ring.TryPush(p * kValuesEach + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Values from one producer arrive in the order it pushed them.
+  std::vector<int> next(kProducers, 0);
+  for (int popped = 0; popped < kProducers * kValuesEach;) {
+    int value;
+    if (!ring.TryPop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int producer = value / kValuesEach;
+    EXPECT_EQ(value % kValuesEach, next[producer]++);
+    ++popped;
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(ring.Empty());
+}
+
+}  // namespace
+}  // namespace rd::bitcask
@@ -0,0 +1,118 @@
+#include "sharded_bitcask.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+// Prefix of each shard's subdirectory, followed by its index.
+constexpr std::string_view kShardPrefix = "shard_";
+
+// 64-bit FNV-1a.
+//
+// 💡: not `std::hash`, for two reasons. Shard assignment is persisted (a key
+// must land in the same shard after a restart, or a rebuild with another
+// standard library), and `std::hash` makes no such promise. And each shard's
+// KeyDir buckets keys by `std::hash` - routing by the same hash would leave
+// every shard with keys that all share a residue, clumping its buckets.
+uint64_t ShardHash(std::string_view key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+}  // namespace
+
+ShardedBitcask ShardedBitcask::Open(const std::string& directory_name,
+                                    size_t num_shards, Options options) {
+  if (num_shards == 0) {
+    throw std::invalid_argument("A ShardedBitcask needs at least one shard");
+  }
+  fs::path directory(directory_name);
+  fs::create_directories(directory);
+  size_t existing_shards = 0;
+  for (const auto& entry : fs::directory_iterator(directory)) {
+    if (entry.is_directory() &&
+        entry.path().filename().string().rfind(kShardPrefix, 0) == 0) {
+      ++existing_shards;
+    }
+  }
+  if (existing_shards != 0 && existing_shards != num_shards) {
+    throw std::invalid_argument(
+        directory_name + " has " + std::to_string(existing_shards) +
+        " shards, not " + std::to_string(num_shards));
+  }
+
+  const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+  options.writer_thread = true;
+  std::vector<std::unique_ptr<Bitcask>> shards;
+  shards.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    options.writer_cpu = static_cast<int>(i % cpus);
+    fs::path shard_path = directory / (std::string(kShardPrefix) +
+                                       std::to_string(i));
+    // 💡: `Bitcask` can't be moved, but `new` initializes it straight from
+    // the prvalue `Open` returns.
+    shards.emplace_back(
+        new Bitcask(Bitcask::Open(shard_path.string(), options)));
+  }
+  return ShardedBitcask(std::move(shards));
+}
+
+void ShardedBitcask::Put(const std::string& key, std::string value) {
+  shards_[ShardOf(key)]->Put(key, std::move(value));
+}
+
+void ShardedBitcask::Put(const std::string& key, std::string value,
+                         std::chrono::microseconds ttl) {
+  shards_[ShardOf(key)]->Put(key, std::move(value), ttl);
+}
+
+std::string ShardedBitcask::Get(const std::string& key) const {
+  return shards_[ShardOf(key)]->Get(key);
+}
+
+void ShardedBitcask::Delete(const std::string& key) {
+  shards_[ShardOf(key)]->Delete(key);
+}
+
+std::vector<std::string> ShardedBitcask::ListKeys() const {
+  std::vector<std::string> keys;
+  for (const auto& shard : shards_) {
+    std::vector<std::string> shard_keys = shard->ListKeys();
+    keys.insert(keys.end(), std::make_move_iterator(shard_keys.begin()),
+                std::make_move_iterator(shard_keys.end()));
+  }
+  return keys;
+}
+
+void ShardedBitcask::Merge() {
+  for (auto& shard : shards_) {
+    shard->Merge();
+  }
+}
+
+BitcaskStats ShardedBitcask::Stats() const {
+  BitcaskStats stats;
+  for (const auto& shard : shards_) {
+    stats.Merge(shard->Stats());
+  }
+  return stats;
+}
+
+size_t ShardedBitcask::ShardOf(std::string_view key) const {
+  return ShardHash(key) % shards_.size();
+}
+
+}  // namespace rd::bitcask
@@ -0,0 +1,68 @@
+// Bitcask partitioned by key over several independent instances.
+//
+// Each shard is a whole `Bitcask` - its own directory, active file, KeyDir
+// and writer thread - so writes to different shards share nothing: no lock,
+// no stream, no cache lines. Every shard's writer thread is pinned to its
+// own core, and callers on any thread are routed by the hash of their key.
+// Writes scale with the number of shards until cores (or the disk) run out.
+
+#ifndef RD_BITCASK_SHARDED_BITCASK_H_
+#define RD_BITCASK_SHARDED_BITCASK_H_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitcask.h"
+
+namespace rd::bitcask {
+
+class ShardedBitcask {
+ public:
+  // Opens (or creates) `num_shards` Bitcasks in subdirectories of
+  // `directory_name`, each with `options` plus a writer thread (see
+  // `Options::writer_thread`) pinned to a core of its own where possible.
+  //
+  // Keys are assigned to shards by their hash modulo `num_shards`, so a
+  // directory must always be opened with the same number of shards. Throws
+  // `std::invalid_argument` if it holds a different number.
+  static ShardedBitcask Open(const std::string& directory_name,
+                             size_t num_shards, Options options = {});
+
+  // As `Bitcask`'s, on the shard that owns `key`. Safe to call from any
+  // thread.
+  void Put(const std::string& key, std::string value);
+  void Put(const std::string& key, std::string value,
+           std::chrono::microseconds ttl);
+  std::string Get(const std::string& key) const;
+  void Delete(const std::string& key);
+
+  // Lists the keys of every shard (grouped by shard, in no particular order).
+  std::vector<std::string> ListKeys() const;
+
+  // Merges every shard in turn.
+  void Merge();
+
+  // The stats of every shard added together (see `BitcaskStats::Merge`).
+  BitcaskStats Stats() const;
+
+  // Routing: the shard that owns `key`, for operations (e.g. `Snapshot`) that
+  // aren't forwarded above.
+  size_t ShardOf(std::string_view key) const;
+  Bitcask& shard(size_t index) { return *shards_[index]; }
+  const Bitcask& shard(size_t index) const { return *shards_[index]; }
+  size_t num_shards() const { return shards_.size(); }
+
+ private:
+  explicit ShardedBitcask(std::vector<std::unique_ptr<Bitcask>> shards)
+      : shards_(std::move(shards)) {}
+
+  std::vector<std::unique_ptr<Bitcask>> shards_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_SHARDED_BITCASK_H_
@@ -0,0 +1,88 @@
+#include "sharded_bitcask.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+using ::testing::TempDir;
+using ::testing::UnorderedElementsAre;
+
+class ShardedBitcaskTest : public testing::Test {
+ protected:
+  ShardedBitcaskTest() {
+    const testing::TestInfo* const test_info =
+        testing::UnitTest::GetInstance()->current_test_info();
+
+    cask_dir_ =
+        fs::path(TempDir()) / test_info->test_case_name() / test_info->name();
+    fs::create_directories(fs::path(cask_dir_));
+  }
+
+  ~ShardedBitcaskTest() { fs::remove_all(cask_dir_); }
+
+  fs::path cask_dir_;
+};
+
+TEST_F(ShardedBitcaskTest, RoutesKeysToShards) {
+  constexpr int kKeys = 100;
+  {
+    auto bc = ShardedBitcask::Open(cask_dir_, 4);
+    ASSERT_EQ(bc.num_shards(), 4);
+    for (int i = 0; i < kKeys; ++i) {
+      bc.Put(std::to_string(i), "val" + std::to_string(i));
+    }
+    bc.Delete("0");
+    EXPECT_THROW(bc.Get("0"), MissingKeyException);
+    EXPECT_EQ(bc.Get("1"), "val1");
+    EXPECT_EQ(bc.shard(bc.ShardOf("1")).Get("1"), "val1");
+    EXPECT_EQ(bc.ListKeys().size(), kKeys - 1);
+
+    // Every shard gets a share, and the stats add them up.
+    BitcaskStats stats = bc.Stats();
+    EXPECT_EQ(stats.keydir_entries, kKeys - 1);
+    EXPECT_EQ(stats.put_latency.count(), kKeys);
+    EXPECT_EQ(stats.cask_files, 4);
+    for (size_t i = 0; i < bc.num_shards(); ++i) {
+      EXPECT_GT(bc.shard(i).Stats().keydir_entries, 0);
+    }
+  }
+
+  // Keys stay in their shards across restarts.
+  auto bc = ShardedBitcask::Open(cask_dir_, 4);
+  bc.Merge();
+  EXPECT_EQ(bc.ListKeys().size(), kKeys - 1);
+  EXPECT_EQ(bc.Get("99"), "val99");
+  EXPECT_THROW(ShardedBitcask::Open(cask_dir_, 2), std::invalid_argument);
+}
+
+TEST_F(ShardedBitcaskTest, WritesFromManyThreads) {
+  auto bc = ShardedBitcask::Open(cask_dir_, 2);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 100; ++i) {
+        bc.Put(std::to_string(t) + "_" + std::to_string(i), "val");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(bc.ListKeys().size(), 400);
+  bc.Put("a", "1");
+  bc.Put("b", "2");
+  EXPECT_EQ(bc.Get("a"), "1");
+  EXPECT_EQ(bc.Get("b"), "2");
+}
+
+}  // namespace
+}  // namespace rd::bitcask
@@ -0,0 +1,137 @@
+#include "spill_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+constexpr size_t kInitialCapacity = 1024;
+
+// Grow once the table is this full (in 1/8ths); linear probing degrades
+// quickly past ~75%.
+constexpr size_t kMaxLoadEighths = 6;
+
+[[noreturn]] void ThrowErrno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+}  // namespace
+
+static_assert(sizeof(SpillIndex::Slot) == 56, "Slot layout changed");
+
+SpillIndex::SpillIndex(std::filesystem::path path)
+    : SpillIndex(std::move(path), kInitialCapacity) {}
+
+SpillIndex::SpillIndex(std::filesystem::path path, size_t capacity)
+    : path_(std::move(path)) {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    ThrowErrno("open " + path_.string());
+  }
+  Map(capacity);
+}
+
+SpillIndex::~SpillIndex() {
+  Unmap();
+  close(fd_);
+  unlink(path_.c_str());
+}
+
+void SpillIndex::Map(size_t capacity) {
+  size_t bytes = capacity * sizeof(Slot);
+  // 💡: extending a file with ftruncate leaves a hole that reads back as
+  // zeroes, i.e. a table of unoccupied slots, without writing anything.
+  if (ftruncate(fd_, bytes) != 0) {
+    ThrowErrno("ftruncate " + path_.string());
+  }
+  void* mapped =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapped == MAP_FAILED) {
+    ThrowErrno("mmap " + path_.string());
+  }
+  slots_ = static_cast<Slot*>(mapped);
+  mask_ = capacity - 1;
+  size_ = 0;
+}
+
+void SpillIndex::Unmap() {
+  if (slots_ != nullptr) {
+    munmap(slots_, file_bytes());
+    slots_ = nullptr;
+  }
+}
+
+void SpillIndex::Grow() {
+  // Rehash into a new file and swap it in, so the index never has to fit in
+  // memory.
+  // Keeps the extension, so a leftover from a crash is cleaned up along with
+  // the index itself.
+  std::filesystem::path grown_path =
+      path_.parent_path() /
+      (path_.stem().string() + "-grow" + path_.extension().string());
+  SpillIndex grown(grown_path, capacity() * 2);
+  for (size_t i = 0; i < capacity(); ++i) {
+    if (slots_[i].occupied) {
+      *grown.Insert(slots_[i].hash) = slots_[i];
+    }
+  }
+  std::filesystem::rename(grown_path, path_);
+
+  // `grown` takes the old table with it (its unlink of `grown_path` is then a
+  // no-op).
+  std::swap(fd_, grown.fd_);
+  std::swap(slots_, grown.slots_);
+  std::swap(mask_, grown.mask_);
+  std::swap(size_, grown.size_);
+}
+
+SpillIndex::Slot* SpillIndex::Insert(uint64_t hash) {
+  if ((size_ + 1) * 8 > capacity() * kMaxLoadEighths) {
+    Grow();
+  }
+  size_t i = hash & mask_;
+  while (slots_[i].occupied) {
+    i = (i + 1) & mask_;
+  }
+  slots_[i] = {.hash = hash, .occupied = true};
+  ++size_;
+  return &slots_[i];
+}
+
+void SpillIndex::Erase(Slot* slot) {
+  // Backward-shift deletion: pull later entries of the probe sequence into the
+  // hole whenever that doesn't move them before their home slot, so lookups
+  // never need tombstones.
+  size_t hole = slot - slots_;
+  for (size_t i = (hole + 1) & mask_; slots_[i].occupied;
+       i = (i + 1) & mask_) {
+    size_t home = slots_[i].hash & mask_;
+    // Whether `home` lies cyclically in (hole, i], in which case the entry
+    // can't move to `hole`.
+    bool stays = hole <= i ? (hole < home && home <= i)
+                           : (hole < home || home <= i);
+    if (!stays) {
+      slots_[hole] = slots_[i];
+      hole = i;
+    }
+  }
+  slots_[hole] = {};
+  --size_;
+}
+
+uint32_t SpillIndex::FileIndex(const std::string& file_id) {
+  auto [itr, inserted] = file_indices_.try_emplace(file_id, file_ids_.size());
+  if (inserted) {
+    file_ids_.push_back(file_id);
+  }
+  return itr->second;
+}
+
+}  // namespace rd::bitcask
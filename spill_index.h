@@ -0,0 +1,128 @@
+// On-disk hash index for KeyDir entries evicted from memory.
+//
+// A linear-probing hash table in a memory-mapped file. Each slot holds a fixed
+// 56 bytes: the key's hash and where its latest value lives, but not the key
+// itself - that is already in the cask file, just before the value. A lookup
+// probes from the hash's home slot and confirms candidates against the key on
+// disk, which `Bitcask` folds into reading the value, so a cold Get costs the
+// same single read as a hot one plus whatever index pages the kernel has to
+// fault in.
+//
+// The index is scratch space: it is rebuilt by every `Open` and unlinked when
+// destroyed.
+
+#ifndef RD_BITCASK_SPILL_INDEX_H_
+#define RD_BITCASK_SPILL_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "compression.h"
+
+namespace rd::bitcask {
+
+class SpillIndex {
+ public:
+  struct Slot {
+    uint64_t hash = 0;
+    uint64_t value_pos = 0;
+    uint64_t value_sz = 0;
+    int64_t timestamp = 0;
+    int64_t expiry = 0;
+    uint32_t key_sz = 0;
+    // Index into the file table (see `FileIndex`).
+    uint32_t file_index = 0;
+    CodecId codec = CodecId::kNone;
+    bool occupied = false;
+  };
+
+  // Creates (truncating) the index file at `path`. Throws
+  // `std::system_error` if the file can't be created or mapped.
+  explicit SpillIndex(std::filesystem::path path);
+  ~SpillIndex();
+
+  SpillIndex(const SpillIndex&) = delete;
+  SpillIndex& operator=(const SpillIndex&) = delete;
+
+  static uint64_t Hash(std::string_view key) {
+    return std::hash<std::string_view>()(key);
+  }
+
+  // Returns the occupied slot with `hash` for which `is_key(slot)` is true, or
+  // nullptr. `is_key` is only called for slots whose hash matches.
+  template <typename IsKey>
+  Slot* Find(uint64_t hash, IsKey is_key) {
+    for (size_t i = hash & mask_; slots_[i].occupied; i = (i + 1) & mask_) {
+      if (slots_[i].hash == hash && is_key(slots_[i])) {
+        return &slots_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Claims a free slot for `hash` (which must not already be present) and
+  // returns it for the caller to fill in. May grow the index, which
+  // invalidates every `Slot*` handed out before.
+  Slot* Insert(uint64_t hash);
+
+  // Frees `slot`. Later slots in its probe sequence are shifted back, so
+  // erasing may move any other slot.
+  void Erase(Slot* slot);
+
+  // Erases every occupied slot for which `pred(slot)` is true.
+  template <typename Pred>
+  void EraseIf(Pred pred) {
+    // Erasing only ever shifts later slots back into the hole, so re-checking
+    // the current position is enough to see every slot.
+    for (size_t i = 0; i < capacity(); ++i) {
+      while (slots_[i].occupied && pred(slots_[i])) {
+        Erase(&slots_[i]);
+      }
+    }
+  }
+
+  // Maps file IDs to the compact indices stored in slots. Files are never
+  // forgotten, so indices stay valid.
+  uint32_t FileIndex(const std::string& file_id);
+  const std::string& file_id(uint32_t file_index) const {
+    return file_ids_[file_index];
+  }
+  const std::vector<std::string>& file_ids() const { return file_ids_; }
+
+  // Slots are addressable by position for iteration; unoccupied ones are
+  // ignored. Positions are only stable until the next `Insert` or `Erase`.
+  size_t capacity() const { return mask_ + 1; }
+  Slot& slot(size_t i) { return slots_[i]; }
+  const Slot& slot(size_t i) const { return slots_[i]; }
+
+  size_t size() const { return size_; }
+  uint64_t file_bytes() const { return capacity() * sizeof(Slot); }
+
+ private:
+  SpillIndex(std::filesystem::path path, size_t capacity);
+
+  // Maps a zeroed table of `capacity` slots (a power of two) from `path_`.
+  void Map(size_t capacity);
+  void Unmap();
+
+  // Rehashes into a table twice the size.
+  void Grow();
+
+  const std::filesystem::path path_;
+  int fd_ = -1;
+  Slot* slots_ = nullptr;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+
+  std::vector<std::string> file_ids_;
+  std::unordered_map<std::string, uint32_t> file_indices_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_SPILL_INDEX_H_
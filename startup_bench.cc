@@ -0,0 +1,226 @@
+// Measures how long `Bitcask::Open` takes to rebuild the KeyDir.
+//
+// Generates a directory of cask files with a configurable mix of fresh
+// writes, overwrites and deletes, then opens it `--runs` times and reports
+// wall time, bytes read and peak RSS for each open.
+//
+// Command:
+//   $ ./build/startup_bench --files=20 --entries_per_file=500000
+//       --overwrite_ratio=0.5 --delete_ratio=0.1
+//
+// Flags:
+//   --db                Directory of the cask (default /tmp/bitcask_startup).
+//   --reuse             Skip generation if `--db` already exists (default
+//                       false).
+//   --files             Number of cask files to generate (default 10).
+//   --entries_per_file  Entries written to each file (default 100000).
+//   --overwrite_ratio   Fraction of writes that overwrite an existing key
+//                       (default 0.3).
+//   --delete_ratio      Fraction of writes that delete an existing key
+//                       (default 0.05).
+//   --key_size          Bytes per key, at least 16 (default 16).
+//   --value_size        Bytes per value (default 100).
+//   --runs              Number of times to open the cask (default 3).
+//   --drop_cache        Evict the cask files from the page cache before each
+//                       open, to measure a cold start (default true).
+//
+// Generation happens in a forked child so that its memory use doesn't show up
+// in the peak RSS reported for opening.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "bitcask.h"
+#include "workload.h"
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+struct Config {
+  std::string db;
+  bool reuse;
+  int files;
+  int64_t entries_per_file;
+  double overwrite_ratio;
+  double delete_ratio;
+  size_t key_size;
+  size_t value_size;
+  int runs;
+  bool drop_cache;
+};
+
+Config ParseConfig(int argc, char** argv) {
+  workload::Flags flags(argc, argv);
+  Config config;
+  config.db = flags.GetString("db", "/tmp/bitcask_startup");
+  config.reuse = flags.GetBool("reuse", false);
+  config.files = flags.GetInt("files", 10);
+  config.entries_per_file = flags.GetInt("entries_per_file", 100'000);
+  config.overwrite_ratio = flags.GetDouble("overwrite_ratio", 0.3);
+  config.delete_ratio = flags.GetDouble("delete_ratio", 0.05);
+  config.key_size = flags.GetInt("key_size", 16);
+  config.value_size = flags.GetInt("value_size", 100);
+  config.runs = flags.GetInt("runs", 3);
+  config.drop_cache = flags.GetBool("drop_cache", true);
+  flags.CheckAllUsed();
+
+  if (config.key_size < 16 ||
+      config.overwrite_ratio + config.delete_ratio > 1) {
+    std::cerr << "Invalid flag combination\n";
+    std::exit(1);
+  }
+  return config;
+}
+
+// `workload::KeyName` padded out to `size` bytes.
+std::string Key(uint64_t i, size_t size) {
+  std::string key = workload::KeyName(i);
+  key.resize(size, '.');
+  return key;
+}
+
+void Generate(const Config& config) {
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> coin(0, 1);
+  uint64_t num_keys = 0;
+
+  for (int file = 0; file < config.files; ++file) {
+    // Each `Open` starts a new file.
+    auto bc = Bitcask::Open(config.db);
+    for (int64_t i = 0; i < config.entries_per_file; ++i) {
+      double op = coin(rng);
+      if (num_keys == 0 || op >= config.overwrite_ratio + config.delete_ratio) {
+        bc.Put(Key(num_keys++, config.key_size),
+               workload::RandomValue(config.value_size, rng));
+      } else if (op < config.overwrite_ratio) {
+        bc.Put(Key(rng() % num_keys, config.key_size),
+               workload::RandomValue(config.value_size, rng));
+      } else {
+        bc.Delete(Key(rng() % num_keys, config.key_size));
+      }
+    }
+  }
+}
+
+// Returns the named counter from /proc/self/io (0 if unavailable).
+uint64_t ProcIo(const std::string& name) {
+  std::ifstream io("/proc/self/io");
+  std::string field;
+  uint64_t value;
+  while (io >> field >> value) {
+    if (field == name + ":") {
+      return value;
+    }
+  }
+  return 0;
+}
+
+// Returns the named field (in KiB) from /proc/self/status.
+uint64_t ProcStatusKb(const std::string& name) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind(name + ":", 0) == 0) {
+      return std::stoull(line.substr(name.size() + 1));
+    }
+  }
+  return 0;
+}
+
+// Resets the VmHWM ("high water mark") of /proc/self/status to the current
+// RSS, so it only covers what happens next. Returns false if the kernel
+// doesn't allow it, leaving VmHWM the peak since the process started.
+bool ResetPeakRss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.flush();
+  return clear_refs.good();
+}
+
+}  // namespace
+}  // namespace rd::bitcask
+
+int main(int argc, char** argv) {
+  using namespace rd::bitcask;
+  namespace fs = ::std::filesystem;
+
+  Config config = ParseConfig(argc, argv);
+
+  if (!(config.reuse && fs::exists(config.db))) {
+    fs::remove_all(config.db);
+    auto start = std::chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child == 0) {
+      Generate(config);
+      _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "Generation failed\n";
+      return 1;
+    }
+    std::cout << "generated " << config.files << " files in " << std::fixed
+              << std::setprecision(2)
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << "s\n";
+  }
+
+  uintmax_t data_size = 0;
+  int num_files = 0;
+  for (const auto& file_entry : fs::directory_iterator(config.db)) {
+    data_size += file_entry.file_size();
+    ++num_files;
+  }
+  std::cout << "cask: " << num_files << " files, " << std::fixed
+            << std::setprecision(1) << data_size / 1e6 << " MB\n";
+
+  for (int run = 0; run < config.runs; ++run) {
+    if (config.drop_cache) {
+      workload::DropPageCache(config.db);
+    }
+    // Otherwise the peak would include earlier runs.
+    bool peak_is_per_open = ResetPeakRss();
+    uint64_t rss_before_kb = ProcStatusKb("VmRSS");
+    uint64_t rchar_before = ProcIo("rchar");
+    uint64_t read_bytes_before = ProcIo("read_bytes");
+    auto start = std::chrono::steady_clock::now();
+
+    {
+      auto bc = Bitcask::Open(config.db);
+      double elapsed = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      uint64_t rchar = ProcIo("rchar") - rchar_before;
+      uint64_t read_bytes = ProcIo("read_bytes") - read_bytes_before;
+      uint64_t rss_kb = ProcStatusKb("VmRSS") - rss_before_kb;
+      uint64_t peak_rss_kb = ProcStatusKb("VmHWM");
+      size_t num_keys = bc.ListKeys().size();
+
+      std::cout << "open " << run << ": " << std::setprecision(3) << elapsed
+                << "s, " << std::setprecision(0) << num_keys / elapsed
+                << " keys/s, " << std::setprecision(1)
+                << data_size / elapsed / 1e6 << " MB/s, read "
+                << rchar / 1e6 << " MB (" << read_bytes / 1e6
+                << " MB from storage), rss +"
+                << rss_kb / 1024.0 << " MiB, "
+                << (peak_is_per_open ? "peak rss " : "process peak rss ")
+                << peak_rss_kb / 1024.0 << " MiB, " << num_keys
+                << " live keys\n";
+    }
+    workload::RemoveEmptyFiles(config.db);
+  }
+  return 0;
+}
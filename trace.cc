@@ -0,0 +1,94 @@
+#include "trace.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string_view>
+
+namespace rd::bitcask {
+namespace {
+
+uint32_t CurrentThreadId() {
+  static std::atomic<uint32_t> next_thread_id{1};
+  thread_local uint32_t thread_id =
+      next_thread_id.fetch_add(1, std::memory_order_relaxed);
+  return thread_id;
+}
+
+// Appends `value` to `output` as a JSON string literal.
+void AppendJsonString(std::string_view value, std::string* output) {
+  output->push_back('"');
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        output->append("\\\"");
+        break;
+      case '\\':
+        output->append("\\\\");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          output->append(escaped);
+        } else {
+          output->push_back(c);
+        }
+    }
+  }
+  output->push_back('"');
+}
+
+}  // namespace
+
+ChromeTraceWriter::ChromeTraceWriter(const std::string& path)
+    : output_(path, std::ios::trunc) {
+  output_ << "[";
+}
+
+ChromeTraceWriter::~ChromeTraceWriter() { output_ << "\n]\n"; }
+
+void ChromeTraceWriter::Record(const TraceEvent& event) {
+  // Timestamps are in (fractional) microseconds.
+  std::string line = "{\"name\":";
+  AppendJsonString(event.name, &line);
+  line.append(",\"cat\":\"bitcask\",\"ph\":\"X\",\"ts\":")
+      .append(std::to_string(event.start_ns / 1000.0))
+      .append(",\"dur\":")
+      .append(std::to_string(event.duration_ns / 1000.0))
+      .append(",\"pid\":")
+      .append(std::to_string(getpid()))
+      .append(",\"tid\":")
+      .append(std::to_string(event.thread_id));
+  if (!event.detail.empty()) {
+    line.append(",\"args\":{\"detail\":");
+    AppendJsonString(event.detail, &line);
+    line.append("}");
+  }
+  line.append("}");
+
+  std::lock_guard<std::mutex> lock(mu_);
+  output_ << (first_ ? "\n" : ",\n") << line;
+  first_ = false;
+}
+
+ScopedSpan::~ScopedSpan() {
+  if (sink_ == nullptr) {
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+  sink_->Record({
+      .name = name_,
+      .detail = std::move(detail_),
+      .start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      start_.time_since_epoch())
+                      .count(),
+      .duration_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_)
+              .count(),
+      .thread_id = CurrentThreadId(),
+  });
+}
+
+}  // namespace rd::bitcask
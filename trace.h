@@ -0,0 +1,91 @@
+// Lightweight tracing of Bitcask's hot paths.
+//
+// Instrumented code opens a `ScopedSpan` around each phase worth seeing on a
+// timeline; the span reports its start and duration to a `TraceSink` when it
+// ends. Sinks are pluggable - `ChromeTraceWriter` writes the Chrome trace
+// event format, which chrome://tracing and https://ui.perfetto.dev load
+// directly.
+//
+// Tracing is off unless a sink is configured, and a span without a sink does
+// nothing at all (not even read the clock), so the instrumentation can stay in
+// the hot paths.
+
+#ifndef RD_BITCASK_TRACE_H_
+#define RD_BITCASK_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace rd::bitcask {
+
+// A completed span.
+struct TraceEvent {
+  // Static string naming the phase, e.g. "Put.Flush".
+  const char* name;
+  // Optional free-form detail, e.g. the file being scanned.
+  std::string detail;
+  // Start time (steady clock) and duration, in nanoseconds.
+  int64_t start_ns;
+  int64_t duration_ns;
+  // Small, stable per-thread number (not the OS thread ID).
+  uint32_t thread_id;
+};
+
+// Receives spans as they complete. Implementations must be thread-safe.
+class TraceSink {
+ public:
+  virtual ~TraceSink() = default;
+
+  virtual void Record(const TraceEvent& event) = 0;
+};
+
+// Writes spans to a file as a Chrome trace event JSON array ("X" events).
+//
+// The closing bracket is written on destruction, but the format tolerates it
+// being missing, so a trace from a crashed process still loads.
+class ChromeTraceWriter : public TraceSink {
+ public:
+  explicit ChromeTraceWriter(const std::string& path);
+  ~ChromeTraceWriter() override;
+
+  void Record(const TraceEvent& event) override;
+
+ private:
+  std::mutex mu_;
+  std::ofstream output_;
+  bool first_ = true;
+};
+
+// Times the enclosing scope and reports it to `sink` (if any) on destruction.
+class ScopedSpan {
+ public:
+  ScopedSpan(TraceSink* sink, const char* name)
+      : sink_(sink), name_(name) {
+    if (sink_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~ScopedSpan();
+
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+  // Whether the span is being recorded. Check this before building an
+  // expensive detail string.
+  bool enabled() const { return sink_ != nullptr; }
+
+  void set_detail(std::string detail) { detail_ = std::move(detail); }
+
+ private:
+  TraceSink* sink_;
+  const char* name_;
+  std::string detail_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_TRACE_H_
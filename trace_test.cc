@@ -0,0 +1,88 @@
+#include "trace.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rd::bitcask {
+namespace {
+
+namespace fs = ::std::filesystem;
+
+using ::testing::HasSubstr;
+using ::testing::StartsWith;
+
+// Collects every event it is given.
+class VectorSink : public TraceSink {
+ public:
+  void Record(const TraceEvent& event) override { events.push_back(event); }
+
+  std::vector<TraceEvent> events;
+};
+
+std::string ReadFile(const fs::path& path) {
+  std::ifstream input(path);
+  std::stringstream contents;
+  contents << input.rdbuf();
+  return contents.str();
+}
+
+TEST(ScopedSpanTest, RecordsNestedSpans) {
+  VectorSink sink;
+  {
+    ScopedSpan outer(&sink, "outer");
+    {
+      ScopedSpan inner(&sink, "inner");
+      inner.set_detail("detail");
+    }
+  }
+
+  ASSERT_EQ(sink.events.size(), 2);
+  const TraceEvent& inner = sink.events[0];
+  const TraceEvent& outer = sink.events[1];
+  EXPECT_STREQ(inner.name, "inner");
+  EXPECT_EQ(inner.detail, "detail");
+  EXPECT_STREQ(outer.name, "outer");
+  EXPECT_EQ(inner.thread_id, outer.thread_id);
+  EXPECT_GE(inner.start_ns, outer.start_ns);
+  EXPECT_LE(inner.start_ns + inner.duration_ns,
+            outer.start_ns + outer.duration_ns);
+}
+
+TEST(ScopedSpanTest, DoesNothingWithoutSink) {
+  ScopedSpan span(nullptr, "ignored");
+  EXPECT_FALSE(span.enabled());
+}
+
+TEST(ChromeTraceWriterTest, WritesTraceEvents) {
+  fs::path path = fs::path(testing::TempDir()) / "trace.json";
+  {
+    ChromeTraceWriter writer(path);
+    writer.Record({.name = "Put",
+                   .detail = "a \"quoted\"\nkey",
+                   .start_ns = 1500,
+                   .duration_ns = 2000,
+                   .thread_id = 3});
+    std::thread([&] { ScopedSpan span(&writer, "Get"); }).join();
+  }
+
+  std::string trace = ReadFile(path);
+  EXPECT_THAT(trace, StartsWith("[\n{"));
+  EXPECT_THAT(trace, HasSubstr("{\"name\":\"Put\",\"cat\":\"bitcask\","
+                               "\"ph\":\"X\",\"ts\":1.500000,"
+                               "\"dur\":2.000000,"));
+  EXPECT_THAT(trace, HasSubstr(",\"tid\":3,\"args\":{\"detail\":"
+                               "\"a \\\"quoted\\\"\\u000akey\"}}"));
+  EXPECT_THAT(trace, HasSubstr("},\n{\"name\":\"Get\""));
+  EXPECT_THAT(trace, ::testing::EndsWith("}\n]\n"));
+  fs::remove(path);
+}
+
+}  // namespace
+}  // namespace rd::bitcask
@@ -0,0 +1,141 @@
+#include "value_cache.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace rd::bitcask {
+namespace {
+
+// Rough cost of an entry beyond its key and value: the list node, the index
+// node and bucket, and the strings' own fields.
+constexpr size_t kEntryOverhead = 128;
+
+}  // namespace
+
+size_t ValueCache::Charge(std::string_view key, const std::string& value) {
+  return kEntryOverhead + key.size() + value.size();
+}
+
+bool ValueCache::Lookup(std::string_view key, std::string* value) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto found = index_.find(key);
+  if (found == index_.end() || found->second->list >= kRecentGhost) {
+    return false;
+  }
+  // Seen at least twice now.
+  MoveTo(found->second, kFrequent);
+  *value = found->second->value;
+  return true;
+}
+
+void ValueCache::Insert(std::string_view key, std::string value) {
+  const size_t charge = Charge(key, value);
+  std::lock_guard<std::mutex> lock(mu_);
+  auto found = index_.find(key);
+  if (charge > capacity_) {
+    if (found != index_.end()) {
+      Remove(found->second);
+    }
+    return;
+  }
+
+  ListId list = kRecent;
+  bool frequent_ghost_hit = false;
+  if (found != index_.end()) {
+    List::iterator itr = found->second;
+    // 💡: the paper's adaptation step. A ghost hit means the list it was
+    // evicted from deserved more room, in proportion to how much smaller
+    // that ghost list is than the other (weighted by bytes here).
+    const size_t recent_ghosts = std::max<size_t>(1, bytes_[kRecentGhost]);
+    const size_t frequent_ghosts =
+        std::max<size_t>(1, bytes_[kFrequentGhost]);
+    if (itr->list == kRecentGhost) {
+      size_t step = std::max<size_t>(1, frequent_ghosts / recent_ghosts);
+      recent_target_ = std::min(capacity_, recent_target_ + step * charge);
+    } else if (itr->list == kFrequentGhost) {
+      size_t step = std::max<size_t>(1, recent_ghosts / frequent_ghosts);
+      recent_target_ -= std::min(recent_target_, step * charge);
+      frequent_ghost_hit = true;
+    }
+    // Whether a ghost coming back or another reader caching the same value,
+    // it's been seen before.
+    list = kFrequent;
+    Remove(itr);
+  }
+
+  MakeRoom(charge, frequent_ghost_hit);
+  lists_[list].push_front(
+      {.key = std::string(key), .value = std::move(value), .charge = charge,
+       .list = list});
+  bytes_[list] += charge;
+  index_[lists_[list].front().key] = lists_[list].begin();
+  TrimGhosts();
+}
+
+void ValueCache::Erase(std::string_view key) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    Remove(found->second);
+  }
+}
+
+size_t ValueCache::size_bytes() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return resident_bytes();
+}
+
+void ValueCache::MoveTo(List::iterator itr, ListId list) {
+  bytes_[itr->list] -= itr->charge;
+  lists_[list].splice(lists_[list].begin(), lists_[itr->list], itr);
+  itr->list = list;
+  bytes_[list] += itr->charge;
+  if (list >= kRecentGhost) {
+    std::string().swap(itr->value);
+  }
+}
+
+void ValueCache::Remove(List::iterator itr) {
+  index_.erase(itr->key);
+  bytes_[itr->list] -= itr->charge;
+  lists_[itr->list].erase(itr);
+}
+
+void ValueCache::MakeRoom(size_t incoming, bool frequent_ghost_hit) {
+  while (resident_bytes() + incoming > capacity_) {
+    const size_t recent = bytes_[kRecent];
+    bool from_recent =
+        !lists_[kRecent].empty() &&
+        (recent > recent_target_ ||
+         (frequent_ghost_hit && recent == recent_target_) ||
+         lists_[kFrequent].empty());
+    if (from_recent) {
+      MoveTo(std::prev(lists_[kRecent].end()), kRecentGhost);
+    } else {
+      MoveTo(std::prev(lists_[kFrequent].end()), kFrequentGhost);
+    }
+  }
+}
+
+void ValueCache::TrimGhosts() {
+  // The paper's bounds: the recent list and its ghosts fit in the capacity,
+  // and everything together in twice that.
+  while (bytes_[kRecent] + bytes_[kRecentGhost] > capacity_ &&
+         !lists_[kRecentGhost].empty()) {
+    Remove(std::prev(lists_[kRecentGhost].end()));
+  }
+  while (resident_bytes() + bytes_[kRecentGhost] + bytes_[kFrequentGhost] >
+         2 * capacity_) {
+    ListId ghosts =
+        lists_[kFrequentGhost].empty() ? kRecentGhost : kFrequentGhost;
+    if (lists_[ghosts].empty()) {
+      break;
+    }
+    Remove(std::prev(lists_[ghosts].end()));
+  }
+}
+
+}  // namespace rd::bitcask
@@ -0,0 +1,101 @@
+// In-memory cache of decoded values, in front of `Bitcask::Get`'s disk read.
+//
+// Replacement is ARC (Megiddo & Modha, "ARC: A Self-Tuning, Low Overhead
+// Replacement Cache"), weighted by bytes rather than entries. Values seen once
+// sit in a "recent" list and values seen again move to a "frequent" one. Each
+// list has a ghost list remembering the keys it evicted, without the values.
+// A miss on a ghost grows the share of the budget its list gets. A one-off
+// scan only churns the recent list and never re-hits its ghosts, so it can't
+// flush out the frequently read values the way it would from an LRU.
+//
+// Thread-safe: Gets sharing the Bitcask's lock use it concurrently.
+
+#ifndef RD_BITCASK_VALUE_CACHE_H_
+#define RD_BITCASK_VALUE_CACHE_H_
+
+#include <array>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace rd::bitcask {
+
+class ValueCache {
+ public:
+  // Holds up to `capacity_bytes` of keys and values (plus a fixed per-entry
+  // overhead).
+  explicit ValueCache(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+  ValueCache(const ValueCache&) = delete;
+  ValueCache& operator=(const ValueCache&) = delete;
+
+  // Copies the value cached for `key` into `value`, returning false if there
+  // isn't one.
+  bool Lookup(std::string_view key, std::string* value);
+
+  // Caches `value` for `key`, typically after a `Lookup` missed. Values too
+  // large for the whole cache aren't kept.
+  void Insert(std::string_view key, std::string value);
+
+  // Forgets `key`, e.g. because it was overwritten or deleted.
+  void Erase(std::string_view key);
+
+  // Bytes charged for the values held (ghosts aside).
+  size_t size_bytes() const;
+
+ private:
+  enum ListId : size_t {
+    kRecent,
+    kFrequent,
+    // Keys evicted from the lists above; their values are gone.
+    kRecentGhost,
+    kFrequentGhost,
+  };
+
+  struct Entry {
+    std::string key;
+    std::string value;
+    size_t charge;
+    ListId list;
+  };
+  // Most recently used first.
+  using List = std::list<Entry>;
+
+  // Bytes an entry is charged for, ghost or not, so ghosts track what their
+  // list would have held.
+  static size_t Charge(std::string_view key, const std::string& value);
+
+  // Moves `itr` to the front of `list`, dropping its value if that's a ghost
+  // list.
+  void MoveTo(List::iterator itr, ListId list);
+  void Remove(List::iterator itr);
+
+  // Demotes resident entries to ghosts until `incoming` more bytes fit.
+  // `frequent_ghost_hit` tips the choice towards the recent list when it's
+  // exactly at its target.
+  void MakeRoom(size_t incoming, bool frequent_ghost_hit);
+
+  // Drops the oldest ghosts until the ghost lists are back within bounds.
+  void TrimGhosts();
+
+  size_t resident_bytes() const {
+    return bytes_[kRecent] + bytes_[kFrequent];
+  }
+
+  mutable std::mutex mu_;
+  const size_t capacity_;
+  // Bytes the recent list aims for; the frequent list gets the rest. Adapts
+  // to ghost hits ("p" in the paper).
+  size_t recent_target_ = 0;
+  std::array<List, 4> lists_;
+  std::array<size_t, 4> bytes_ = {};
+  // Keys point into the entries, which list nodes never move.
+  std::unordered_map<std::string_view, List::iterator> index_;
+};
+
+}  // namespace rd::bitcask
+
+#endif  // RD_BITCASK_VALUE_CACHE_H_
@@ -0,0 +1,71 @@
+#include "value_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace rd::bitcask {
+namespace {
+
+TEST(ValueCacheTest, CachesAndInvalidates) {
+  ValueCache cache(4096);
+  std::string value;
+  EXPECT_FALSE(cache.Lookup("key", &value));
+
+  cache.Insert("key", "val");
+  ASSERT_TRUE(cache.Lookup("key", &value));
+  EXPECT_EQ(value, "val");
+  EXPECT_GT(cache.size_bytes(), 0);
+
+  cache.Erase("key");
+  EXPECT_FALSE(cache.Lookup("key", &value));
+  EXPECT_EQ(cache.size_bytes(), 0);
+
+  // Too large to ever fit.
+  cache.Insert("big", std::string(8192, 'x'));
+  EXPECT_FALSE(cache.Lookup("big", &value));
+}
+
+TEST(ValueCacheTest, StaysWithinCapacity) {
+  constexpr size_t kCapacity = 16 * 1024;
+  ValueCache cache(kCapacity);
+  std::string value;
+  for (int i = 0; i < 1000; ++i) {
+    std::string key = std::to_string(i % 300);
+    if (!cache.Lookup(key, &value)) {
+      cache.Insert(key, std::string(i % 200, 'x'));
+    }
+    ASSERT_LE(cache.size_bytes(), kCapacity);
+  }
+}
+
+TEST(ValueCacheTest, ResistsScans) {
+  // Room for about 10 entries.
+  constexpr size_t kValueSize = 1000;
+  ValueCache cache(10 * (kValueSize + 150));
+  std::string value;
+  auto read = [&](const std::string& key) {
+    if (cache.Lookup(key, &value)) {
+      return true;
+    }
+    cache.Insert(key, std::string(kValueSize, 'x'));
+    return false;
+  };
+
+  // A hot set, read repeatedly...
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 5; ++i) {
+      read("hot" + std::to_string(i));
+    }
+  }
+  // ...survives a scan of many more keys than fit, each read once.
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_FALSE(read("scan" + std::to_string(i)));
+  }
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(read("hot" + std::to_string(i))) << i;
+  }
+}
+
+}  // namespace
+}  // namespace rd::bitcask
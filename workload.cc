@@ -0,0 +1,210 @@
+#include "workload.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace rd::bitcask::workload {
+namespace {
+
+// FNV-1a over the bytes of `v`, used to scatter Zipfian ranks.
+uint64_t Fnv1a(uint64_t v) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (int i = 0; i < 8; ++i) {
+    hash ^= v & 0xff;
+    hash *= 0x100000001b3ull;
+    v >>= 8;
+  }
+  return hash;
+}
+
+[[noreturn]] void Die(const std::string& message) {
+  std::cerr << message << "\n";
+  std::exit(1);
+}
+
+}  // namespace
+
+std::string KeyName(uint64_t i) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "user%012llu",
+                static_cast<unsigned long long>(i));
+  return buffer;
+}
+
+std::string RandomValue(size_t size, std::mt19937_64& rng) {
+  std::string value(size, '\0');
+  for (char& c : value) {
+    c = 'a' + rng() % 26;
+  }
+  return value;
+}
+
+ZipfianGenerator::ZipfianGenerator(uint64_t n, double theta)
+    : theta_(theta),
+      alpha_(1.0 / (1.0 - theta)),
+      zeta_2_(1.0 + std::pow(0.5, theta)) {
+  Grow(std::max<uint64_t>(n, 1));
+}
+
+void ZipfianGenerator::Grow(uint64_t n) {
+  for (uint64_t i = n_ + 1; i <= n; ++i) {
+    zeta_n_ += 1.0 / std::pow(static_cast<double>(i), theta_);
+  }
+  n_ = n;
+  eta_ = (1.0 - std::pow(2.0 / n_, 1.0 - theta_)) / (1.0 - zeta_2_ / zeta_n_);
+}
+
+uint64_t ZipfianGenerator::Next(uint64_t n, std::mt19937_64& rng) {
+  if (n > n_) {
+    Grow(n);
+  }
+  double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+  double uz = u * zeta_n_;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < zeta_2_) {
+    return 1;
+  }
+  uint64_t rank = n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_);
+  return std::min(rank, n - 1);
+}
+
+std::optional<Distribution> ParseDistribution(std::string_view name) {
+  if (name == "uniform") return Distribution::kUniform;
+  if (name == "zipfian") return Distribution::kZipfian;
+  if (name == "latest") return Distribution::kLatest;
+  return std::nullopt;
+}
+
+KeyChooser::KeyChooser(Distribution distribution, uint64_t num_keys,
+                       double zipf_theta)
+    : distribution_(distribution), zipfian_(num_keys, zipf_theta) {}
+
+uint64_t KeyChooser::Next(uint64_t num_keys, std::mt19937_64& rng) {
+  switch (distribution_) {
+    case Distribution::kUniform:
+      return rng() % num_keys;
+    case Distribution::kZipfian:
+      return Fnv1a(zipfian_.Next(num_keys, rng)) % num_keys;
+    case Distribution::kLatest:
+      return num_keys - 1 - zipfian_.Next(num_keys, rng);
+  }
+  return 0;
+}
+
+Flags::Flags(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 2) != "--") {
+      Die("Unexpected argument: " + std::string(arg));
+    }
+    arg.remove_prefix(2);
+    auto equals = arg.find('=');
+    std::string name(arg.substr(0, equals));
+    // A bare `--flag` is shorthand for `--flag=true`.
+    values_[name] = equals == std::string_view::npos
+                        ? "true"
+                        : std::string(arg.substr(equals + 1));
+    used_[name] = false;
+  }
+}
+
+std::string Flags::GetString(const std::string& name,
+                             const std::string& default_value) {
+  auto itr = values_.find(name);
+  if (itr == values_.end()) {
+    return default_value;
+  }
+  used_[name] = true;
+  return itr->second;
+}
+
+int64_t Flags::GetInt(const std::string& name, int64_t default_value) {
+  std::string value = GetString(name, "");
+  if (value.empty()) {
+    return default_value;
+  }
+  char* end;
+  int64_t parsed = std::strtoll(value.c_str(), &end, 10);
+  if (*end != '\0') {
+    Die("--" + name + " expects an integer, got: " + value);
+  }
+  return parsed;
+}
+
+double Flags::GetDouble(const std::string& name, double default_value) {
+  std::string value = GetString(name, "");
+  if (value.empty()) {
+    return default_value;
+  }
+  char* end;
+  double parsed = std::strtod(value.c_str(), &end);
+  if (*end != '\0') {
+    Die("--" + name + " expects a number, got: " + value);
+  }
+  return parsed;
+}
+
+bool Flags::GetBool(const std::string& name, bool default_value) {
+  std::string value = GetString(name, "");
+  if (value.empty()) {
+    return default_value;
+  }
+  if (value != "true" && value != "false") {
+    Die("--" + name + " expects true/false, got: " + value);
+  }
+  return value == "true";
+}
+
+void Flags::CheckAllUsed() const {
+  for (const auto& [name, used] : used_) {
+    if (!used) {
+      Die("Unknown flag: --" + name);
+    }
+  }
+}
+
+void PrintLatencies(std::ostream& output, std::string_view name,
+                    const Histogram& latencies_ns) {
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+  output << std::left << std::setw(8) << name << std::right << std::fixed
+         << std::setprecision(1) << " ops=" << latencies_ns.count()
+         << " mean=" << latencies_ns.mean() / 1000.0
+         << "us p50=" << us(latencies_ns.Percentile(50))
+         << "us p90=" << us(latencies_ns.Percentile(90))
+         << "us p99=" << us(latencies_ns.Percentile(99))
+         << "us p99.9=" << us(latencies_ns.Percentile(99.9))
+         << "us max=" << us(latencies_ns.max()) << "us\n";
+}
+
+void DropPageCache(const std::filesystem::path& dir) {
+  for (const auto& file_entry : std::filesystem::directory_iterator(dir)) {
+    int fd = open(file_entry.path().c_str(), O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    // Dirty pages can't be dropped, so make sure they've been written back.
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+void RemoveEmptyFiles(const std::filesystem::path& dir) {
+  for (const auto& file_entry : std::filesystem::directory_iterator(dir)) {
+    if (file_entry.file_size() == 0) {
+      std::filesystem::remove(file_entry.path());
+    }
+  }
+}
+
+}  // namespace rd::bitcask::workload
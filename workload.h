@@ -0,0 +1,115 @@
+// Shared pieces of the load-generating tools (`main` and friends): key naming,
+// key distributions, value generation, command-line flags and cask directory
+// housekeeping.
+
+#ifndef RD_BITCASK_WORKLOAD_H_
+#define RD_BITCASK_WORKLOAD_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "histogram.h"
+
+namespace rd::bitcask::workload {
+
+// Name of the `i`th key: "user" followed by 12 zero-padded digits.
+std::string KeyName(uint64_t i);
+
+// Random printable value of `size` bytes.
+std::string RandomValue(size_t size, std::mt19937_64& rng);
+
+// Generates integers in [0, n) following a Zipfian distribution, with 0 the
+// most popular. Uses the method from Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases" (as YCSB does), and supports `n` growing
+// between calls by extending the zeta constant incrementally.
+class ZipfianGenerator {
+ public:
+  // YCSB's default skew.
+  static constexpr double kDefaultTheta = 0.99;
+
+  explicit ZipfianGenerator(uint64_t n, double theta = kDefaultTheta);
+
+  uint64_t Next(uint64_t n, std::mt19937_64& rng);
+
+ private:
+  // Extends `zeta_n_` (and dependent constants) to cover `n` items.
+  void Grow(uint64_t n);
+
+  double theta_;
+  double alpha_;
+  double zeta_2_;
+  uint64_t n_ = 0;
+  double zeta_n_ = 0;
+  double eta_ = 0;
+};
+
+// How operations choose which key to touch.
+enum class Distribution {
+  // Every key is equally likely.
+  kUniform,
+  // A few keys are very hot. Popularity ranks are scattered across the key
+  // space so hot keys aren't adjacent.
+  kZipfian,
+  // Recently inserted keys are the most popular.
+  kLatest,
+};
+
+// Parses "uniform", "zipfian" or "latest".
+std::optional<Distribution> ParseDistribution(std::string_view name);
+
+// Picks key numbers according to a `Distribution`.
+class KeyChooser {
+ public:
+  KeyChooser(Distribution distribution, uint64_t num_keys,
+             double zipf_theta = ZipfianGenerator::kDefaultTheta);
+
+  // Returns a key number in [0, num_keys). `num_keys` may grow over time.
+  uint64_t Next(uint64_t num_keys, std::mt19937_64& rng);
+
+ private:
+  Distribution distribution_;
+  ZipfianGenerator zipfian_;
+};
+
+// Minimal `--name=value` command-line flags.
+class Flags {
+ public:
+  // Exits with a usage message on malformed arguments.
+  Flags(int argc, char** argv);
+
+  std::string GetString(const std::string& name,
+                        const std::string& default_value);
+  int64_t GetInt(const std::string& name, int64_t default_value);
+  double GetDouble(const std::string& name, double default_value);
+  bool GetBool(const std::string& name, bool default_value);
+
+  // Exits with an error if any flag was passed but never asked for (typos).
+  void CheckAllUsed() const;
+
+ private:
+  std::map<std::string, std::string> values_;
+  std::map<std::string, bool> used_;
+};
+
+// Writes one line summarizing `latencies_ns` in microseconds, prefixed with
+// `name`.
+void PrintLatencies(std::ostream& output, std::string_view name,
+                    const Histogram& latencies_ns);
+
+// Evicts the files in `dir` from the page cache so the next reads have to go
+// to disk.
+void DropPageCache(const std::filesystem::path& dir);
+
+// Removes the empty files each `Open` leaves behind, so repeatedly opening a
+// directory doesn't slowly change what is being measured.
+void RemoveEmptyFiles(const std::filesystem::path& dir);
+
+}  // namespace rd::bitcask::workload
+
+#endif  // RD_BITCASK_WORKLOAD_H_
@@ -0,0 +1,352 @@
+// Driver for the YCSB core workloads.
+//
+// Each workload gets a fresh cask: a load phase inserts `--record_count`
+// records, then a run phase performs `--operation_count` operations in the
+// workload's mix. The two phases are timed and reported separately, in a
+// format close to YCSB's own so results can be compared side by side.
+//
+// Command:
+//   $ ./build/ycsb --workloads=a,b,c --record_count=1000000 --threads=4
+//
+// Flags:
+//   --workloads        Comma-separated subset of a-f (default a,b,c,d,e,f).
+//   --db               Directory of the cask (default /tmp/bitcask_ycsb).
+//   --record_count     Records inserted by the load phase (default 100000).
+//   --operation_count  Operations performed by the run phase (default 100000).
+//   --threads          Client threads (default 1).
+//   --field_count      Fields per record (default 10).
+//   --field_length     Bytes per field (default 100).
+//   --max_scan_length  Longest scan in workload E (default 100).
+//   --writer_thread    Use `Options::writer_thread` (default false).
+//
+// Records are stored as a single value holding every field, so an update
+// rewrites the whole record (YCSB's `writeallfields=true`). The cask keeps an
+// ordered index (`Options::ordered_index`) for workload E's scans, which list
+// the keys from the start key on and then read each record, as YCSB's own
+// key/value bindings do.
+//
+// NOTE: `Bitcask` isn't thread-safe without `--writer_thread`, so every
+// operation is then serialized on a mutex.
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bitcask.h"
+#include "histogram.h"
+#include "workload.h"
+
+namespace rd::bitcask {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Sorts after every key (they're all "user" followed by digits), as the end
+// of an open-ended scan.
+constexpr std::string_view kEndOfKeys = "\xff";
+
+// Proportions of each operation in a workload; they sum to 1.
+struct Workload {
+  char name;
+  double read = 0;
+  double update = 0;
+  double insert = 0;
+  double scan = 0;
+  double read_modify_write = 0;
+  workload::Distribution distribution = workload::Distribution::kZipfian;
+};
+
+// The standard core workloads (see YCSB's workloads/workload[a-f]).
+const std::vector<Workload>& CoreWorkloads() {
+  static const auto* workloads = new std::vector<Workload>{
+      {.name = 'a', .read = 0.5, .update = 0.5},
+      {.name = 'b', .read = 0.95, .update = 0.05},
+      {.name = 'c', .read = 1.0},
+      {.name = 'd',
+       .read = 0.95,
+       .insert = 0.05,
+       .distribution = workload::Distribution::kLatest},
+      {.name = 'e', .insert = 0.05, .scan = 0.95},
+      {.name = 'f', .read = 0.5, .read_modify_write = 0.5},
+  };
+  return *workloads;
+}
+
+struct Config {
+  std::string workloads;
+  std::string db;
+  uint64_t record_count;
+  uint64_t operation_count;
+  int threads;
+  int field_count;
+  int field_length;
+  int max_scan_length;
+  bool writer_thread;
+};
+
+enum Operation { kRead, kUpdate, kInsert, kScan, kReadModifyWrite, kNumOps };
+
+constexpr const char* kOperationNames[kNumOps] = {"READ", "UPDATE", "INSERT",
+                                                  "SCAN", "READ-MODIFY-WRITE"};
+
+struct PhaseStats {
+  Histogram latencies[kNumOps];
+  uint64_t failures[kNumOps] = {};
+
+  void Merge(const PhaseStats& other) {
+    for (int i = 0; i < kNumOps; ++i) {
+      latencies[i].Merge(other.latencies[i]);
+      failures[i] += other.failures[i];
+    }
+  }
+};
+
+class Driver {
+ public:
+  Driver(const Config& config, const Workload& workload)
+      : config_(config),
+        workload_(workload),
+        bitcask_(Bitcask::Open(config.db,
+                               {.ordered_index = true,
+                                .writer_thread = config.writer_thread})),
+        key_count_(config.record_count) {}
+
+  void Load() {
+    std::atomic<uint64_t> next = 0;
+    RunPhase("LOAD", [&](std::mt19937_64& rng, PhaseStats& stats) {
+      for (uint64_t i; (i = next.fetch_add(1)) < config_.record_count;) {
+        Time(stats, kInsert, [&] { return Insert(i, rng); });
+      }
+    });
+  }
+
+  void Run() {
+    std::atomic<int64_t> remaining = config_.operation_count;
+    RunPhase("RUN", [&](std::mt19937_64& rng, PhaseStats& stats) {
+      workload::KeyChooser chooser(workload_.distribution,
+                                   config_.record_count);
+      std::uniform_real_distribution<double> coin(0, 1);
+      while (remaining.fetch_sub(1) > 0) {
+        RunOperation(coin(rng), chooser, rng, stats);
+      }
+    });
+  }
+
+ private:
+  template <typename Fn>
+  void RunPhase(const std::string& phase, Fn fn) {
+    std::vector<PhaseStats> stats(config_.threads);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (int i = 0; i < config_.threads; ++i) {
+      threads.emplace_back([&, i] {
+        std::mt19937_64 rng(i + 1);
+        fn(rng, stats[i]);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double elapsed_ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+
+    PhaseStats total;
+    uint64_t ops = 0;
+    for (const auto& s : stats) {
+      total.Merge(s);
+    }
+    for (const auto& latencies : total.latencies) {
+      ops += latencies.count();
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "[" << phase << "], Workload, " << workload_.name << "\n";
+    std::cout << "[" << phase << "], RunTime(ms), " << elapsed_ms << "\n";
+    std::cout << "[" << phase << "], Throughput(ops/sec), "
+              << ops / elapsed_ms * 1000 << "\n";
+    for (int op = 0; op < kNumOps; ++op) {
+      const Histogram& latencies = total.latencies[op];
+      if (latencies.count() == 0) {
+        continue;
+      }
+      std::string prefix = std::string("[") + kOperationNames[op] + "], ";
+      auto us = [](uint64_t ns) { return ns / 1000.0; };
+      std::cout << prefix << "Operations, " << latencies.count() << "\n"
+                << prefix << "AverageLatency(us), " << latencies.mean() / 1000
+                << "\n"
+                << prefix << "MinLatency(us), " << us(latencies.min()) << "\n"
+                << prefix << "MaxLatency(us), " << us(latencies.max()) << "\n"
+                << prefix << "95thPercentileLatency(us), "
+                << us(latencies.Percentile(95)) << "\n"
+                << prefix << "99thPercentileLatency(us), "
+                << us(latencies.Percentile(99)) << "\n"
+                << prefix << "Failures, " << total.failures[op] << "\n";
+    }
+  }
+
+  template <typename Fn>
+  static void Time(PhaseStats& stats, Operation op, Fn fn) {
+    auto start = Clock::now();
+    if (!fn()) {
+      ++stats.failures[op];
+    }
+    stats.latencies[op].Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start)
+            .count());
+  }
+
+  std::string Record(std::mt19937_64& rng) const {
+    return workload::RandomValue(config_.field_count * config_.field_length,
+                                 rng);
+  }
+
+  bool Insert(uint64_t key_number, std::mt19937_64& rng) {
+    std::string value = Record(rng);
+    auto lock = Lock();
+    bitcask_.Put(workload::KeyName(key_number), std::move(value));
+    return true;
+  }
+
+  bool Read(const std::string& key, std::string* value) {
+    try {
+      auto lock = Lock();
+      *value = bitcask_.Get(key);
+      return true;
+    } catch (const MissingKeyException&) {
+      return false;
+    }
+  }
+
+  bool Update(const std::string& key, std::mt19937_64& rng) {
+    std::string value = Record(rng);
+    auto lock = Lock();
+    bitcask_.Put(key, std::move(value));
+    return true;
+  }
+
+  bool Scan(const std::string& start_key, size_t length) {
+    std::vector<std::string> keys;
+    {
+      auto lock = Lock();
+      keys = bitcask_.Scan(start_key, kEndOfKeys, length);
+    }
+    std::string value;
+    for (const std::string& key : keys) {
+      if (!Read(key, &value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Locks `mu_`, unless the Bitcask does its own locking.
+  std::unique_lock<std::mutex> Lock() {
+    if (config_.writer_thread) {
+      return std::unique_lock<std::mutex>(mu_, std::defer_lock);
+    }
+    return std::unique_lock<std::mutex>(mu_);
+  }
+
+  void RunOperation(double op, workload::KeyChooser& chooser,
+                    std::mt19937_64& rng, PhaseStats& stats) {
+    uint64_t key_count = key_count_.load(std::memory_order_relaxed);
+    auto next_key = [&] {
+      return workload::KeyName(chooser.Next(key_count, rng));
+    };
+
+    if ((op -= workload_.read) < 0) {
+      std::string key = next_key();
+      std::string value;
+      Time(stats, kRead, [&] { return Read(key, &value); });
+    } else if ((op -= workload_.update) < 0) {
+      std::string key = next_key();
+      Time(stats, kUpdate, [&] { return Update(key, rng); });
+    } else if ((op -= workload_.insert) < 0) {
+      uint64_t key_number = key_count_.fetch_add(1);
+      Time(stats, kInsert, [&] { return Insert(key_number, rng); });
+    } else if ((op -= workload_.scan) < 0) {
+      std::string key = next_key();
+      size_t length = std::uniform_int_distribution<size_t>(
+          1, config_.max_scan_length)(rng);
+      Time(stats, kScan, [&] { return Scan(key, length); });
+    } else {
+      std::string key = next_key();
+      Time(stats, kReadModifyWrite, [&] {
+        std::string value;
+        return Read(key, &value) && Update(key, rng);
+      });
+    }
+  }
+
+  const Config& config_;
+  const Workload& workload_;
+  std::mutex mu_;
+  Bitcask bitcask_;
+  // Number of records inserted so far (by both phases).
+  std::atomic<uint64_t> key_count_;
+};
+
+Config ParseConfig(int argc, char** argv) {
+  workload::Flags flags(argc, argv);
+  Config config;
+  config.workloads = flags.GetString("workloads", "a,b,c,d,e,f");
+  config.db = flags.GetString("db", "/tmp/bitcask_ycsb");
+  config.record_count = flags.GetInt("record_count", 100'000);
+  config.operation_count = flags.GetInt("operation_count", 100'000);
+  config.threads = flags.GetInt("threads", 1);
+  config.field_count = flags.GetInt("field_count", 10);
+  config.field_length = flags.GetInt("field_length", 100);
+  config.max_scan_length = flags.GetInt("max_scan_length", 100);
+  config.writer_thread = flags.GetBool("writer_thread", false);
+  flags.CheckAllUsed();
+
+  if (config.threads < 1 || config.record_count < 1 ||
+      config.max_scan_length < 1) {
+    std::cerr << "Invalid flag combination\n";
+    std::exit(1);
+  }
+  return config;
+}
+
+}  // namespace
+}  // namespace rd::bitcask
+
+int main(int argc, char** argv) {
+  using namespace rd::bitcask;
+
+  Config config = ParseConfig(argc, argv);
+
+  std::stringstream names(config.workloads);
+  for (std::string name; std::getline(names, name, ',');) {
+    const Workload* workload = nullptr;
+    for (const auto& core : CoreWorkloads()) {
+      if (name.size() == 1 && core.name == name[0]) {
+        workload = &core;
+      }
+    }
+    if (workload == nullptr) {
+      std::cerr << "Unknown workload: " << name << "\n";
+      return 1;
+    }
+
+    std::filesystem::remove_all(config.db);
+    {
+      Driver driver(config, *workload);
+      driver.Load();
+      driver.Run();
+    }
+    std::filesystem::remove_all(config.db);
+  }
+  return 0;
+}